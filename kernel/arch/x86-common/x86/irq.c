@@ -6,6 +6,7 @@
 #include <debug.h>
 #include <syscalls.h>
 #include <errno.h>
+#include <time.h>
 
 extern int page_fault(size_t address, int present,
                        int write, int user, int exec);
@@ -127,6 +128,7 @@ context_t* x86_irq_handler(context_t* ctx)
     {
       /* when the timer interrupt fires, run
        * the scheduler. */
+      timer_tick();
       ctx = schedule(ctx);
     }
 
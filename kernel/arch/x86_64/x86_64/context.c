@@ -49,6 +49,15 @@ context_t* context_init(void* kstack_ptr, void* entry_addr, void* stack_ptr,
   return ctx;
 }
 
+context_t* context_fork(void* kstack_ptr, void* parent_kstack_ptr)
+{
+  /* entering the kernel from user mode always saves
+   * the context right at the top of the kernel stack. */
+  context_t* ctx = (context_t*)kstack_ptr - 1;
+  *ctx = *((context_t*)parent_kstack_ptr - 1);
+  return ctx;
+}
+
 void context_set_pc(context_t* ctx, size_t pc)
 {
   ctx->rip = pc;
@@ -10,7 +10,6 @@
 */
 
 #include <util/types.h>
-#include <util/bitmap.h>
 #include <util/string.h>
 #include <arch/common.h>
 #include <mm/memory.h>
@@ -28,6 +27,10 @@ static size_t __init__ stack_page_count;
  * existing memory location. */
 void setup_page_bitmap(void* bitmap_addr, size_t size);
 
+/* build the buddy allocator's frame table from
+ * the free pages bitmap. */
+void setup_page_frames();
+
 /* initialize a new 64bit GDT with TSS on the
  * kernel heap. */
 extern void setup_gdt();
@@ -46,15 +49,6 @@ static const char* copy_cmdline(bootinfo_t* boot_info)
   return strcpy(kmalloc(strlen(cmdline) + 1), cmdline);
 }
 
-static void copy_page_bitmap(bootinfo_t* boot_info)
-{
-  /* copy the page bitmap into the new heap */
-  const size_t bitmap_size = BITMAP_BYTE_SIZE(boot_info->total_pages);
-  void* new_bitmap = kmalloc(bitmap_size);
-  memcpy(new_bitmap, (void*)boot_info->free_pages_ptr, bitmap_size);
-  setup_page_bitmap(new_bitmap, boot_info->total_pages);
-}
-
 static void* copy_initrd(bootinfo_t* boot_info)
 {
   if (!boot_info->ramdisk_ptr)
@@ -66,7 +60,7 @@ static void* copy_initrd(bootinfo_t* boot_info)
   return initrd;
 }
 
-static void free_pages(size_t start, size_t count)
+static void free_page_range(size_t start, size_t count)
 {
   while (count--)
     free_page(start++);
@@ -75,7 +69,7 @@ static void free_pages(size_t start, size_t count)
 void delete_init_stack()
 {
   debug(INIT, "deleting init stack\n");
-  free_pages(stack_start_page, stack_page_count);
+  free_page_range(stack_start_page, stack_page_count);
 }
 
 void amd64_main(bootinfo_t* bi)
@@ -101,11 +95,15 @@ void amd64_main(bootinfo_t* bi)
    * at this point. */
   vspace_setup(boot_info.pml4_ppn);
 
+  /* switch over to the buddy allocator. the frame
+   * table is seeded from the boot32 bitmap, which
+   * is not used any more afterwards. */
+  setup_page_frames();
+
   /* copy any information that is going to be used
    * by the kernel and that is located in the boot32
    * heap over to the kernel64 heap. */
   const char* cmdline = copy_cmdline(&boot_info);
-  copy_page_bitmap(&boot_info);
   const size_t initrd_size = boot_info.ramdisk_size;
   void* initrd = copy_initrd(&boot_info);
   stack_start_page = boot_info.stack_start_page;
@@ -115,8 +113,8 @@ void amd64_main(bootinfo_t* bi)
    * already copied over to the kernel64 heap, so we
    * can free the pages used by boot32 code/data as well
    * as the boot32 heap. */
-  free_pages(boot_info.boot32_start_page, boot_info.boot32_page_count);
-  free_pages(boot_info.heap_start_page, boot_info.heap_pages);
+  free_page_range(boot_info.boot32_start_page, boot_info.boot32_page_count);
+  free_page_range(boot_info.heap_start_page, boot_info.heap_pages);
 
   x86_irq_init();
 
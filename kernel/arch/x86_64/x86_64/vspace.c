@@ -7,15 +7,35 @@
 #include <mm/memory.h>
 #include <util/string.h>
 #include <debug.h>
+#include <errno.h>
 
 #define IDENT_OFFSET 0xffff800000000000ul
 
 vspace_t _vspace_kernel;
 
-static void tlb_invalidate(size_t virt)
+#define PT_ENTRIES   512
+
+/* invalidating more pages than this one by one is
+ * more expensive than flushing the whole TLB. */
+#define TLB_FLUSH_MAX 32
+
+#define CR0_WP        BIT(16)
+#define CR3_NOFLUSH   BIT(63)
+#define CR4_PGE       BIT(7)
+#define CR4_PCIDE     BIT(17)
+#define PCID_COUNT    4096
+
+/* internal mapping flag: kernel mappings are the same
+ * in every address space, so they are marked global. */
+#define PG_GLOBAL     BIT(8)
+
+void clear_page(void* page)
 {
-  virt <<= PAGE_SHIFT;
-  __asm__ volatile ("invlpg (%0)" : : "b"(virt) : "memory");
+  size_t count = PAGE_SIZE / sizeof(uint64_t);
+  __asm__ volatile ("rep stosq"
+    : "+D"(page), "+c"(count)
+    : "a"(0ul)
+    : "memory");
 }
 
 /*
@@ -35,8 +55,10 @@ typedef struct
   uint64_t cache_disable  : 1;
   uint64_t accessed       : 1;
   uint64_t dirty          : 1;
-  uint64_t zero           : 2;
-  uint64_t available      : 3;
+  uint64_t huge           : 1;  // PS bit, page directory level only
+  uint64_t global         : 1;  // leaf entries only
+  uint64_t cow            : 1;  // read-only copy-on-write page
+  uint64_t available      : 2;
   uint64_t ppn            : 40;
   uint64_t available2     : 11;
   uint64_t no_exec        : 1;
@@ -62,14 +84,158 @@ typedef struct
   /* a pointer to the content of the page mapped
    * at that virtual address. */
   void* page;
+
+  /* set if the address is mapped by a huge page.
+   * in that case, there is no page table (ptble). */
+  int huge;
 } vaddr_t;
 
 struct _vspace_struct
 {
   mutex_t lock;
   size_t pml4_ppn;
+
+  /* the process context identifier tagging this
+   * address space's TLB entries. it is only valid
+   * as long as pcid_gen matches pcid_generation. */
+  size_t pcid;
+  size_t pcid_gen;
 };
 
+/*
+ * with PCIDs, TLB entries of an address space survive
+ * switching to another one. PCIDs are handed out on demand
+ * when an address space is applied. once all of them are
+ * used up, a new generation is started: the whole TLB is
+ * flushed and every address space has to get a new PCID.
+ * PCID 0 belongs to the kernel address space. address
+ * spaces that are changed while not active simply drop
+ * their PCID, which is cheaper than invalidating them.
+ */
+static int pcid_enabled = false;
+static size_t pcid_next = 1;
+static size_t pcid_generation = 1;
+static vspace_t* active_vspace = NULL;
+
+static size_t read_cr4()
+{
+  size_t cr4;
+  __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+  return cr4;
+}
+
+static void write_cr4(size_t cr4)
+{
+  __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+static void tlb_invalidate(size_t virt)
+{
+  virt <<= PAGE_SHIFT;
+  __asm__ volatile ("invlpg (%0)" : : "b"(virt) : "memory");
+}
+
+static void tlb_flush()
+{
+  /* reloading CR3 drops all non-global TLB
+   * entries of the current PCID. */
+  size_t cr3;
+  __asm__ volatile ("mov %%cr3, %0;"
+                    "mov %0, %%cr3;" : "=r"(cr3) : : "memory");
+}
+
+static void tlb_flush_all()
+{
+  /* toggling CR4.PGE drops every TLB entry,
+   * including global ones and those of all PCIDs. */
+  const size_t cr4 = read_cr4();
+  write_cr4(cr4 & ~CR4_PGE);
+  write_cr4(cr4);
+}
+
+static void tlb_invalidate_range(vspace_t* vspace, size_t virt, size_t count)
+{
+  if (vspace != VSPACE_KERNEL && vspace != active_vspace)
+  {
+    /* the TLB entries of an inactive address space are
+     * only around if it owns a PCID, so just drop that. */
+    vspace->pcid_gen = 0;
+    return;
+  }
+
+  if (count > TLB_FLUSH_MAX)
+  {
+    if (vspace == VSPACE_KERNEL)
+      tlb_flush_all();
+    else
+      tlb_flush();
+    return;
+  }
+
+  /* invlpg also drops global entries */
+  for (size_t i = 0; i < count; i++)
+    tlb_invalidate(virt + i);
+}
+
+static void pcid_assign(vspace_t* vspace)
+{
+  if (pcid_next == PCID_COUNT)
+  {
+    debug(VSPACE, "PCIDs exhausted, starting generation %zu\n",
+          pcid_generation + 1);
+    pcid_generation++;
+    pcid_next = 1;
+    tlb_flush_all();
+  }
+
+  vspace->pcid = pcid_next++;
+  vspace->pcid_gen = pcid_generation;
+}
+
+static void setup_global_pages(gpte_t* table, unsigned level)
+{
+  /* mark all leaf entries below the given table as
+   * global. level 4 is the PML4, 1 is a page table. */
+  for (size_t i = 0; i < PT_ENTRIES; i++)
+  {
+    if (!table[i].present)
+      continue;
+
+    if (level == 1 || (level == 2 && table[i].huge))
+      table[i].global = 1;
+    else
+      setup_global_pages(ppn_to_virt(table[i].ppn), level - 1);
+  }
+}
+
+static void setup_pcid()
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  __asm__ volatile ("cpuid"
+    : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+
+  /* global pages (CPUID.1:EDX.PGE) are available on
+   * every x86_64 cpu, PCIDs (CPUID.1:ECX.PCID) are not. */
+  size_t cr4 = read_cr4() | CR4_PGE;
+  write_cr4(cr4);
+
+  if (ecx & BIT(17))
+  {
+    write_cr4(cr4 | CR4_PCIDE);
+    pcid_enabled = true;
+  }
+  debug(INIT, "global pages enabled, PCIDs %s\n",
+        pcid_enabled ? "enabled" : "not supported");
+}
+
+static void make_table(gpte_t* entry)
+{
+  entry->present = 1;
+  entry->write = 1;
+  entry->user = 1;
+  entry->ppn = alloc_page(0);
+}
+
 void vspace_setup(size_t pml4_ppn)
 {
   assert(sizeof(gpte_t) == 8, "gpte_t is not of size 64bit");
@@ -77,10 +243,40 @@ void vspace_setup(size_t pml4_ppn)
   _vspace_kernel.pml4_ppn = pml4_ppn;
   mutex_init(&_vspace_kernel.lock);
 
+  _vspace_kernel.pcid = 0;
+  _vspace_kernel.pcid_gen = 0;
+
   /* clear the lower identity mapping, so we can
    * detect nullpointer dereferences and similar errors. */
-  memset(ppn_to_virt(_vspace_kernel.pml4_ppn), 0, PAGE_SIZE/2);
+  gpte_t* pml4 = ppn_to_virt(_vspace_kernel.pml4_ppn);
+  memset(pml4, 0, PAGE_SIZE/2);
+
+  /* the upper half is the same in every address space,
+   * so its translations may survive switching them. */
+  for (size_t i = PT_ENTRIES/2; i < PT_ENTRIES; i++)
+  {
+    if (pml4[i].present)
+      setup_global_pages(ppn_to_virt(pml4[i].ppn), 3);
+  }
+
+  /* allocate all PML4 entries of the kernel heap up front.
+   * this way, the upper half that is copied into every new
+   * address space never gets out of date, and kernel tasks
+   * can run in any of them. */
+  for (size_t i = (KHEAP_START >> 39) & 0x1ff; i < PT_ENTRIES; i++)
+  {
+    if (!pml4[i].present)
+      make_table(&pml4[i]);
+  }
+
   vspace_apply(VSPACE_KERNEL);
+  setup_pcid();
+
+  /* make the kernel respect read-only pages as well, so
+   * it runs into copy-on-write faults just like user code. */
+  size_t cr0;
+  __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+  __asm__ volatile ("mov %0, %%cr0" : : "r"(cr0 | CR0_WP) : "memory");
 }
 
 static void vspace_update_kernel_mapping(vspace_t* vspace)
@@ -99,7 +295,9 @@ static void vspace_update_kernel_mapping(vspace_t* vspace)
 vspace_t* vspace_create()
 {
   vspace_t* vspace = kmalloc(sizeof(vspace_t));
-  vspace->pml4_ppn = alloc_page();
+  vspace->pml4_ppn = alloc_page(0);
+  vspace->pcid = 0;
+  vspace->pcid_gen = 0;
   mutex_init(&vspace->lock);
   vspace_update_kernel_mapping(vspace);
   return vspace;
@@ -126,6 +324,7 @@ static void resolve_mapping(vspace_t* vspace, size_t virt, vaddr_t* vaddr)
 
   vaddr->pml4_ppn = vspace->pml4_ppn;
   vaddr->pml4e = (gpte_t*)ppn_to_virt(vaddr->pml4_ppn) + vaddr->pml4i;
+  vaddr->huge = false;
 
   if (vaddr->pml4e->present)
   {
@@ -137,7 +336,17 @@ static void resolve_mapping(vspace_t* vspace, size_t virt, vaddr_t* vaddr)
       vaddr->pdir_ppn = vaddr->pdpte->ppn;
       vaddr->pdire = (gpte_t*)ppn_to_virt(vaddr->pdir_ppn) + vaddr->pdiri;
 
-      if (vaddr->pdire->present)
+      if (vaddr->pdire->present && vaddr->pdire->huge)
+      {
+        /* 2 MiB page: the page directory entry is the
+         * leaf, pointing directly to the page frames. */
+        vaddr->huge = true;
+        vaddr->ptbl_ppn = 0;
+        vaddr->ptble = NULL;
+        vaddr->page_ppn = vaddr->pdire->ppn + vaddr->ptbli;
+        vaddr->page = ppn_to_virt(vaddr->page_ppn);
+      }
+      else if (vaddr->pdire->present)
       {
         vaddr->ptbl_ppn = vaddr->pdire->ppn;
         vaddr->ptble = (gpte_t*)ppn_to_virt(vaddr->ptbl_ppn) + vaddr->ptbli;
@@ -184,77 +393,431 @@ static void resolve_mapping(vspace_t* vspace, size_t virt, vaddr_t* vaddr)
   }
 }
 
-void vspace_map(vspace_t *vspace, size_t virt, size_t phys, int flags)
+static void set_leaf(gpte_t* entry, size_t phys, int flags)
 {
-  vaddr_t vaddr;
-  mutex_lock(&vspace->lock);
-  resolve_mapping(vspace, virt, &vaddr);
+  entry->present = 1;
+  entry->no_exec = (flags & PG_NOEXEC) ? 1 : 0;
+  entry->write = (flags & PG_WRITE) ? 1 : 0;
+  entry->user = (flags & PG_USER) ? 1 : 0;
+  entry->global = (flags & PG_GLOBAL) ? 1 : 0;
+  entry->ppn = phys;
+}
 
-  if (!vaddr.pml4e->present)
+static gpte_t* lookup_pdire(vspace_t* vspace, size_t virt, int create)
+{
+  assert(mutex_held(&vspace->lock), "vspace lock not held");
+
+  /* walk down to the page directory entry covering
+   * virt. missing tables are only created on request. */
+  gpte_t* pml4e = (gpte_t*)ppn_to_virt(vspace->pml4_ppn) + ((virt >> 27) & 0x1ff);
+  if (!pml4e->present)
   {
-    vaddr.pml4e->present = 1;
-    vaddr.pml4e->write = 1;
-    vaddr.pml4e->user = 1;
-    vaddr.pml4e->ppn = alloc_page();
-    resolve_mapping(vspace, virt, &vaddr);
+    if (!create)
+      return NULL;
+    make_table(pml4e);
   }
 
-  if (!vaddr.pdpte->present)
+  gpte_t* pdpte = (gpte_t*)ppn_to_virt(pml4e->ppn) + ((virt >> 18) & 0x1ff);
+  if (!pdpte->present)
   {
-    vaddr.pdpte->present = 1;
-    vaddr.pdpte->write = 1;
-    vaddr.pdpte->user = 1;
-    vaddr.pdpte->ppn = alloc_page();
-    resolve_mapping(vspace, virt, &vaddr);
+    if (!create)
+      return NULL;
+    make_table(pdpte);
   }
 
-  if (!vaddr.pdire->present)
+  return (gpte_t*)ppn_to_virt(pdpte->ppn) + ((virt >> 9) & 0x1ff);
+}
+
+static void split_huge_page(gpte_t* pdire)
+{
+  assert(pdire->huge, "split_huge_page(): not a huge page");
+
+  /* replace the huge page by a page table, which maps
+   * the same page frames with the same permissions. from
+   * now on, every frame is owned on its own. */
+  const size_t ptbl_ppn = alloc_page(PAGE_NOZERO);
+  gpte_t* ptbl = ppn_to_virt(ptbl_ppn);
+  for (size_t i = 0; i < PT_ENTRIES; i++)
   {
-    vaddr.pdire->present = 1;
-    vaddr.pdire->write = 1;
-    vaddr.pdire->user = 1;
-    vaddr.pdire->ppn = alloc_page();
-    resolve_mapping(vspace, virt, &vaddr);
+    *(uint64_t*)&ptbl[i] = 0;
+    ptbl[i].present = 1;
+    ptbl[i].write = pdire->write;
+    ptbl[i].user = pdire->user;
+    ptbl[i].no_exec = pdire->no_exec;
+    ptbl[i].global = pdire->global;
+    ptbl[i].ppn = pdire->ppn + i;
   }
 
-  if (!vaddr.ptble->present)
+  debug(VSPACE, "split huge PPN %zu\n", (size_t)pdire->ppn);
+  *(uint64_t*)pdire = 0;
+  pdire->present = 1;
+  pdire->write = 1;
+  pdire->user = 1;
+  pdire->ppn = ptbl_ppn;
+}
+
+/*
+ * page frames released by an unmap operation must not be
+ * reused before the TLB has been flushed. they are collected
+ * in a small batch, which is only released after flushing.
+ */
+#define FREE_BATCH 32
+
+typedef struct
+{
+  size_t count;
+  size_t frames[FREE_BATCH];    // ppn << 4 | order
+} free_batch_t;
+
+static void batch_release(vspace_t* vspace, free_batch_t* batch,
+                          size_t virt, size_t count)
+{
+  if (batch->count == 0)
+    return;
+
+  tlb_invalidate_range(vspace, virt, count);
+  for (size_t i = 0; i < batch->count; i++)
+    free_pages(batch->frames[i] >> 4, batch->frames[i] & 0xf);
+  batch->count = 0;
+}
+
+int vspace_map(vspace_t *vspace, size_t virt, size_t phys, int flags)
+{
+  if (vspace == VSPACE_KERNEL)
+    flags |= PG_GLOBAL;
+
+  mutex_lock(&vspace->lock);
+  gpte_t* pdire = lookup_pdire(vspace, virt, true);
+  if (!pdire->present)
+    make_table(pdire);
+
+  /* a huge page already covers the address, so
+   * it is mapped just like in the 4k case. */
+  int error = -EEXIST;
+  if (!pdire->huge)
   {
-    vaddr.ptble->present = 1;
-    vaddr.ptble->no_exec = (flags & PG_NOEXEC) ? 1 : 0;
-    vaddr.ptble->write = (flags & PG_WRITE) ? 1 : 0;
-    vaddr.ptble->user = (flags & PG_USER) ? 1 : 0;
-    vaddr.ptble->ppn = phys;
+    gpte_t* ptble = (gpte_t*)ppn_to_virt(pdire->ppn) + (virt % PT_ENTRIES);
+    if (!ptble->present)
+    {
+      set_leaf(ptble, phys, flags);
+      error = SUCCESS;
+    }
   }
 
   debug(VSPACE, "mapped PPN %zu @ %p\n", phys, virt << PAGE_SHIFT);
   tlb_invalidate(virt);
   mutex_unlock(&vspace->lock);
+  return error;
 }
 
-int vspace_unmap(vspace_t *vspace, size_t virt)
+size_t vspace_map_range(vspace_t* vspace, size_t virt, size_t count, int flags)
 {
-  int ret = false;
-  vaddr_t vaddr;
+  const size_t end = virt + count;
+  size_t mapped = 0;
+  if (vspace == VSPACE_KERNEL)
+    flags |= PG_GLOBAL;
+
   mutex_lock(&vspace->lock);
-  resolve_mapping(vspace, virt, &vaddr);
 
-  if (vaddr.page)
+  /* the upper levels are only walked once for
+   * every page table the range touches. */
+  size_t page = virt;
+  while (page < end)
+  {
+    const size_t next = min((page | (PT_ENTRIES - 1)) + 1, end);
+    gpte_t* pdire = lookup_pdire(vspace, page, true);
+    if (pdire->huge)
+    {
+      page = next;
+      continue;
+    }
+
+    if (!pdire->present)
+      make_table(pdire);
+
+    gpte_t* ptbl = ppn_to_virt(pdire->ppn);
+    for (; page < next; page++)
+    {
+      gpte_t* ptble = &ptbl[page % PT_ENTRIES];
+      if (!ptble->present)
+      {
+        set_leaf(ptble, alloc_page(0), flags);
+        mapped++;
+      }
+    }
+  }
+
+  /* only entries that were not present before have
+   * been changed. those are never cached by the TLB,
+   * so there is nothing to invalidate. */
+  debug(VSPACE, "mapped %zu pages @ %p\n", mapped, virt << PAGE_SHIFT);
+  mutex_unlock(&vspace->lock);
+  return mapped;
+}
+
+int vspace_map_huge(vspace_t* vspace, size_t virt, size_t phys, int flags)
+{
+  assert(virt % HUGE_PAGE_PAGES == 0 && phys % HUGE_PAGE_PAGES == 0,
+         "vspace_map_huge(): misaligned huge page");
+  if (vspace == VSPACE_KERNEL)
+    flags |= PG_GLOBAL;
+
+  mutex_lock(&vspace->lock);
+  gpte_t* pdire = lookup_pdire(vspace, virt, true);
+
+  /* only map the huge page if nothing at all is
+   * mapped in its range yet. */
+  if (pdire->present)
   {
-    *(uint64_t*)vaddr.ptble = 0;
-    free_page(vaddr.page_ppn);
-    ret = true;
+    mutex_unlock(&vspace->lock);
+    return -EEXIST;
   }
 
-  debug(VSPACE, "unmapped PPN %zu @ %p\n", vaddr.page_ppn, virt << PAGE_SHIFT);
+  set_leaf(pdire, phys, flags);
+  pdire->huge = 1;
+
+  debug(VSPACE, "mapped huge PPN %zu @ %p\n", phys, virt << PAGE_SHIFT);
   tlb_invalidate(virt);
   mutex_unlock(&vspace->lock);
+  return SUCCESS;
+}
+
+size_t vspace_unmap_range(vspace_t* vspace, size_t virt, size_t count)
+{
+  size_t unmapped = 0;
+  free_batch_t batch = { .count = 0 };
+  const size_t end = virt + count;
+  mutex_lock(&vspace->lock);
+
+  size_t page = virt;
+  size_t flushed = virt;
+  while (page < end)
+  {
+    /* the TLB is flushed once for the whole range,
+     * unless the batch of released frames fills up. */
+    if (batch.count + 1 > FREE_BATCH)
+    {
+      batch_release(vspace, &batch, flushed, page - flushed);
+      flushed = page;
+    }
+
+    const size_t next = min((page | (PT_ENTRIES - 1)) + 1, end);
+    gpte_t* pdire = lookup_pdire(vspace, page, false);
+    if (pdire == NULL || !pdire->present)
+    {
+      page = next;
+      continue;
+    }
+
+    if (pdire->huge)
+    {
+      /* huge pages covered entirely by the range are
+       * released as a whole, all others are split up. */
+      if (next - page == PT_ENTRIES)
+      {
+        batch.frames[batch.count++] = (size_t)pdire->ppn << 4 | HUGE_PAGE_ORDER;
+        *(uint64_t*)pdire = 0;
+        unmapped += PT_ENTRIES;
+        page = next;
+        continue;
+      }
+      split_huge_page(pdire);
+    }
+
+    gpte_t* ptbl = ppn_to_virt(pdire->ppn);
+    for (; page < next && batch.count < FREE_BATCH; page++)
+    {
+      gpte_t* ptble = &ptbl[page % PT_ENTRIES];
+      if (!ptble->present)
+        continue;
+
+      batch.frames[batch.count++] = (size_t)ptble->ppn << 4;
+      *(uint64_t*)ptble = 0;
+      unmapped++;
+    }
+  }
+
+  batch_release(vspace, &batch, flushed, page - flushed);
+  debug(VSPACE, "unmapped %zu pages @ %p\n", unmapped, virt << PAGE_SHIFT);
+  mutex_unlock(&vspace->lock);
+  return unmapped;
+}
+
+int vspace_unmap(vspace_t *vspace, size_t virt)
+{
+  return vspace_unmap_range(vspace, virt, 1) > 0;
+}
+
+void vspace_protect(vspace_t* vspace, size_t virt, size_t count, int flags)
+{
+  const size_t end = virt + count;
+  mutex_lock(&vspace->lock);
+
+  size_t page = virt;
+  while (page < end)
+  {
+    const size_t next = min((page | (PT_ENTRIES - 1)) + 1, end);
+    gpte_t* pdire = lookup_pdire(vspace, page, false);
+    if (pdire == NULL || !pdire->present)
+    {
+      page = next;
+      continue;
+    }
+
+    if (pdire->huge)
+      split_huge_page(pdire);
+
+    /* copy-on-write pages stay read-only, they
+     * become writable when they are copied. frames
+     * which are shared with someone else are copied
+     * first as well. */
+    gpte_t* ptbl = ppn_to_virt(pdire->ppn);
+    for (; page < next; page++)
+    {
+      gpte_t* ptble = &ptbl[page % PT_ENTRIES];
+      if (!ptble->present)
+        continue;
+
+      if ((flags & PG_WRITE) && page_shared(ptble->ppn))
+        ptble->cow = 1;
+      ptble->user = (flags & PG_USER) ? 1 : 0;
+      ptble->no_exec = (flags & PG_NOEXEC) ? 1 : 0;
+      ptble->write = (flags & PG_WRITE) && !ptble->cow ? 1 : 0;
+    }
+  }
+
+  tlb_invalidate_range(vspace, virt, count);
+  debug(VSPACE, "protected %zu pages @ %p\n", count, virt << PAGE_SHIFT);
+  mutex_unlock(&vspace->lock);
+}
+
+static size_t clone_table(gpte_t* table, unsigned level)
+{
+  /* copy a page table (level 1) or a higher level table
+   * of the lower half. the mapped page frames are shared
+   * and turned into copy-on-write pages in both address
+   * spaces, read-only ones too, as they might be made
+   * writable later on. */
+  const size_t clone_ppn = alloc_page(0);
+  gpte_t* clone = ppn_to_virt(clone_ppn);
+  for (size_t i = 0; i < PT_ENTRIES; i++)
+  {
+    if (!table[i].present)
+      continue;
+
+    /* sharing is done at page granularity */
+    if (level == 2 && table[i].huge)
+      split_huge_page(&table[i]);
+
+    if (level > 1)
+    {
+      clone[i] = table[i];
+      clone[i].ppn = clone_table(ppn_to_virt(table[i].ppn), level - 1);
+      continue;
+    }
+
+    table[i].write = 0;
+    table[i].cow = 1;
+    clone[i] = table[i];
+    page_share(table[i].ppn);
+  }
+  return clone_ppn;
+}
+
+vspace_t* vspace_clone(vspace_t* vspace)
+{
+  vspace_t* clone = vspace_create();
+
+  mutex_lock(&vspace->lock);
+  gpte_t* pml4 = ppn_to_virt(vspace->pml4_ppn);
+  gpte_t* clone_pml4 = ppn_to_virt(clone->pml4_ppn);
+  for (size_t i = 0; i < PT_ENTRIES/2; i++)
+  {
+    if (!pml4[i].present)
+      continue;
+
+    clone_pml4[i] = pml4[i];
+    clone_pml4[i].ppn = clone_table(ppn_to_virt(pml4[i].ppn), 3);
+  }
+
+  /* writable pages of the original address space
+   * have become read-only, so drop all of them. */
+  tlb_invalidate_range(vspace, 0, (size_t)-1);
+  mutex_unlock(&vspace->lock);
+
+  debug(VSPACE_INFO, "cloned address space %p -> %p\n", vspace, clone);
+  return clone;
+}
+
+int vspace_cow(vspace_t* vspace, size_t virt)
+{
+  int ret = -EFAULT;
+  mutex_lock(&vspace->lock);
+  gpte_t* pdire = lookup_pdire(vspace, virt, false);
+  if (pdire && pdire->present && !pdire->huge)
+  {
+    gpte_t* ptble = (gpte_t*)ppn_to_virt(pdire->ppn) + (virt % PT_ENTRIES);
+    if (ptble->present && ptble->cow)
+    {
+      /* if the frame is not shared anymore, it can just
+       * be made writable again. sharing can only increase
+       * while the vspace lock is held, so this is safe. */
+      if (page_shared(ptble->ppn))
+      {
+        const size_t ppn = alloc_page(PAGE_NOZERO);
+        memcpy(ppn_to_virt(ppn), ppn_to_virt(ptble->ppn), PAGE_SIZE);
+        free_page(ptble->ppn);
+        ptble->ppn = ppn;
+      }
+
+      ptble->cow = 0;
+      ptble->write = 1;
+      tlb_invalidate_range(vspace, virt, 1);
+      debug(VSPACE, "resolved copy-on-write @ %p\n", virt << PAGE_SHIFT);
+      ret = SUCCESS;
+    }
+  }
+  mutex_unlock(&vspace->lock);
   return ret;
 }
 
+int vspace_mapped(vspace_t* vspace, size_t virt)
+{
+  vaddr_t vaddr;
+  mutex_lock(&vspace->lock);
+  resolve_mapping(vspace, virt, &vaddr);
+  mutex_unlock(&vspace->lock);
+  return vaddr.page != NULL;
+}
+
+int vspace_is_huge(vspace_t* vspace, size_t virt)
+{
+  vaddr_t vaddr;
+  mutex_lock(&vspace->lock);
+  resolve_mapping(vspace, virt, &vaddr);
+  mutex_unlock(&vspace->lock);
+  return vaddr.huge;
+}
+
 void vspace_apply(vspace_t *vspace)
 {
-  void* phys_addr = (void*)(vspace->pml4_ppn << PAGE_SHIFT);
-  __asm __volatile__ ("mov %0, %%cr3;" : : "r"(phys_addr));
+  if (vspace == active_vspace)
+    return;
+
+  size_t cr3 = vspace->pml4_ppn << PAGE_SHIFT;
+  if (pcid_enabled)
+  {
+    /* as long as the address space's PCID is valid,
+     * its TLB entries can be kept. */
+    if (vspace != VSPACE_KERNEL && vspace->pcid_gen != pcid_generation)
+      pcid_assign(vspace);
+    else
+      cr3 |= CR3_NOFLUSH;
+    cr3 |= vspace->pcid;
+  }
+
+  active_vspace = vspace;
+  __asm __volatile__ ("mov %0, %%cr3;" : : "r"(cr3) : "memory");
 }
 
 void* virt_to_phys(vspace_t* vspace, void *virt_addr)
@@ -281,6 +844,13 @@ void vspace_delete(vspace_t *vspace)
   if (!vspace_delete)
     return;
 
+  /* kernel tasks borrow the address space that was active
+   * before them, so it might still be in use. */
+  preempt_disable();
+  if (active_vspace == vspace)
+    vspace_apply(VSPACE_KERNEL);
+  preempt_enable();
+
   debug(VSPACE_INFO, "deleting address space %p\n", vspace);
   gpte_t* pml4 = ppn_to_virt(pml4_ppn);
   for (size_t pml4i = 0; pml4i < 256; pml4i++)
@@ -302,6 +872,12 @@ void vspace_delete(vspace_t *vspace)
         if (!pdir[pdiri].present)
           continue;
 
+        if (pdir[pdiri].huge)
+        {
+          free_pages(pdir[pdiri].ppn, HUGE_PAGE_ORDER);
+          continue;
+        }
+
         const size_t ptbl_ppn = pdir[pdiri].ppn;
         gpte_t* ptbl = ppn_to_virt(ptbl_ppn);
         for (size_t ptbli = 0; ptbli < 512; ptbli++)
@@ -505,11 +505,19 @@ static bd_driver_t ata_bd_driver = {
   }
 };
 
-static void ata_setup_dma(pci_ide_dev_t* controller, uint8_t channel)
+static int ata_setup_dma(pci_ide_dev_t* controller, uint8_t channel)
 {
   /* allocate a DMA buffer that doesn't cross 64K boundaries
    * and resides in physical memory below 4GB */
-  void* phys_buffer = alloc_dma_region();
+  const size_t size = PRD_PAGES * PAGE_SIZE;
+  void* phys_buffer = alloc_dma_region(size, PAGE_SIZE, size);
+  if (phys_buffer == NULL)
+  {
+    debug(ATADISK, "ata-dma: no DMA region for channel %u\n",
+          (unsigned)channel);
+    return -ENOMEM;
+  }
+
   controller->ide_channels[channel].prdt = phys_to_virt(phys_buffer);
   controller->ide_channels[channel].prdt->buffer =
       (size_t)phys_buffer + BLOCK_SIZE;
@@ -519,6 +527,27 @@ static void ata_setup_dma(pci_ide_dev_t* controller, uint8_t channel)
    * corresponding BusMaster ADDR register */
   size_t busmaster_reg = controller->ide_channels[channel].busmaster;
   outl(busmaster_reg + DMA_ADDR, (size_t)phys_buffer);
+  return SUCCESS;
+}
+
+static void ata_setup_channel(pci_ide_dev_t* controller, uint8_t channel,
+                              size_t irq)
+{
+  ide_dev_t* devices = &controller->ide_devices[channel * 2];
+  if (!devices[0].present && !devices[1].present)
+    return;
+
+  /* without a DMA region, the channel's drives
+   * can't be used, so just ignore them. */
+  if (ata_setup_dma(controller, channel) < 0)
+  {
+    devices[0].present = 0;
+    devices[1].present = 0;
+    return;
+  }
+
+  irq_subscribe(irq, "ata-hdd", ata_irq,
+                &(controller->ide_channels[channel]));
 }
 
 static void* ata_probe(pci_dev_t* device)
@@ -572,21 +601,8 @@ static void* ata_probe(pci_dev_t* device)
   ide_identify(controller, ATA_SECONDARY, ATA_SLAVE);
 
   /* setup PCI busmastering DMA */
-  if(controller->ide_devices[0].present ||
-     controller->ide_devices[1].present)
-  {
-    irq_subscribe(IRQ_ATA_PRIM, "ata-hdd", ata_irq,
-                 &(controller->ide_channels[0]));
-    ata_setup_dma(controller, ATA_PRIMARY);
-  }
-
-  if(controller->ide_devices[2].present ||
-     controller->ide_devices[3].present)
-  {
-    irq_subscribe(IRQ_ATA_SEC, "ata-hdd", ata_irq,
-                 &(controller->ide_channels[1]));
-    ata_setup_dma(controller, ATA_SECONDARY);
-  }
+  ata_setup_channel(controller, ATA_PRIMARY, IRQ_ATA_PRIM);
+  ata_setup_channel(controller, ATA_SECONDARY, IRQ_ATA_SEC);
 
   /* enable IRQ's on both channels */
   ide_write(controller, ATA_PRIMARY, ATA_REG_CONTROL, 0);
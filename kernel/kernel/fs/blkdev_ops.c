@@ -34,9 +34,17 @@ static ssize_t bd_write(void* drv, void* buffer, size_t size, uint64_t off)
         bd->data, bd->minor, buffer, count, lba);
   if (blks < 0)
     return blks;
+  bcache_update(bd, buffer, count, lba);
   return blks * BLOCK_SIZE;
 }
 
+bd_t* bd_get(fd_t* fd)
+{
+  if (fd->f_ops.read != bd_read)
+    return NULL;
+  return fd->fs_data;
+}
+
 int bd_open(fd_t **fd_, size_t major, size_t minor)
 {
   mutex_lock(&bd_list_lock);
@@ -47,8 +55,10 @@ int bd_open(fd_t **fd_, size_t major, size_t minor)
     bd_t* bd = list_it_get(it);
     if (bd->minor == minor && bd->driver->major == major)
     {
-      fd_t* fd = kmalloc(sizeof(fd_t));
+      fd_t* fd = kmem_cache_alloc(&fd_cache);
+      fd->file = NULL;
       fd->fpos = 0;
+      mutex_init(&fd->fdmod);
       fd->fs_data = bd;
       fd->f_ops.read = bd_read;
       fd->f_ops.write = bd_write;
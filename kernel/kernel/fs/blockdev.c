@@ -7,6 +7,10 @@
 #include <errno.h>
 #include <debug.h>
 #include <mm/memory.h>
+#include <mm/slab.h>
+#include <mm/writeback.h>
+#include <sched/sched.h>
+#include <time.h>
 
 #define BLKDEV_MODE   {               \
   .u_r = 1, .u_w = 1, .u_x = 0,       \
@@ -25,6 +29,65 @@ static mutex_t driver_list_lock;
 list_t bd_list;
 mutex_t bd_list_lock;
 
+/* the buffer cache keeps recently used device blocks in
+ * memory, so that file system metadata (inode tables,
+ * indirect blocks, directories) does not have to be read
+ * from the disk over and over again. buffers are looked
+ * up by (device, lba) in a hash table and recycled in LRU
+ * order once the cache has reached its maximum size.
+ * buffers written with bd_bwrite() are dirty until the
+ * flusher writes them back, sorted by device and lba and
+ * merged into requests of consecutive blocks. dirty
+ * buffers and buffers which are being written back are
+ * never recycled. if the write fails, they are dirty
+ * again and the device remembers the error. missing
+ * blocks get a buffer before they are read, so that
+ * writes during the read end up in the cache. */
+#define BCACHE_BUCKETS      256
+#define BCACHE_MAX_BUFFERS  2048
+
+/* misses are read from the device in runs of
+ * up to this many blocks. */
+#define BCACHE_RUN_MAX      32
+
+typedef struct _buffer_struct
+{
+  bd_t* bd;
+  uint64_t lba;
+  struct _buffer_struct* hash_next;
+  struct _buffer_struct* lru_prev;
+  struct _buffer_struct* lru_next;
+  int dirty;
+  int writeback;
+  int reading;        // being read from the device
+  int valid;          // data is up to date
+  size_t dirtied;
+  char data[BLOCK_SIZE];
+} buffer_t;
+
+typedef struct
+{
+  bd_t* bd;
+  uint64_t lba;
+} bkey_t;
+
+static kmem_cache_t buffer_cache = KMEM_CACHE_INITIALIZER("buffer_t", sizeof(buffer_t));
+
+static buffer_t* bcache_hash[BCACHE_BUCKETS];
+static buffer_t* lru_head = NULL;
+static buffer_t* lru_tail = NULL;
+static mutex_t bcache_lock = MUTEX_INITIALIZER;
+
+/* usage statistics */
+static size_t buffers = 0;
+static size_t hits = 0;
+static size_t misses = 0;
+static size_t evictions = 0;
+static size_t dirty_buffers = 0;
+static size_t flushed_buffers = 0;
+static size_t flush_requests = 0;
+static size_t write_errors = 0;
+
 void blockdev_init()
 {
   debug(INIT, "initializing blockdevice manager\n");
@@ -73,6 +136,7 @@ void bd_register(bd_t *blkdev)
   assert(blkdev->capacity, "blkdev must have non-zero capacity");
   assert(blkdev->driver, "driver field must be initialized");
 
+  blkdev->wb_error = SUCCESS;
   mutex_lock(&bd_list_lock);
   list_add(&bd_list, blkdev);
   mutex_unlock(&bd_list_lock);
@@ -120,3 +184,410 @@ void blockdev_mknodes()
   }
   mutex_unlock(&bd_list_lock);
 }
+
+static size_t bcache_bucket(bd_t* bd, uint64_t lba)
+{
+  const size_t key = ((size_t)bd >> 4) ^ (lba * 0x9e3779b97f4a7c15ull);
+  return (key >> 32) % BCACHE_BUCKETS;
+}
+
+static buffer_t* bcache_lookup(bd_t* bd, uint64_t lba)
+{
+  assert(mutex_held(&bcache_lock), "buffer cache lock not held");
+  buffer_t* buf = bcache_hash[bcache_bucket(bd, lba)];
+  while (buf && (buf->bd != bd || buf->lba != lba))
+    buf = buf->hash_next;
+  return buf;
+}
+
+static void hash_unlink(buffer_t* buf)
+{
+  buffer_t** link = &bcache_hash[bcache_bucket(buf->bd, buf->lba)];
+  while (*link != buf)
+    link = &(*link)->hash_next;
+  *link = buf->hash_next;
+}
+
+static void lru_unlink(buffer_t* buf)
+{
+  if (buf->lru_prev)
+    buf->lru_prev->lru_next = buf->lru_next;
+  else
+    lru_head = buf->lru_next;
+  if (buf->lru_next)
+    buf->lru_next->lru_prev = buf->lru_prev;
+  else
+    lru_tail = buf->lru_prev;
+}
+
+static void lru_push(buffer_t* buf)
+{
+  buf->lru_prev = NULL;
+  buf->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = buf;
+  else
+    lru_tail = buf;
+  lru_head = buf;
+}
+
+static buffer_t* bcache_insert(bd_t* bd, uint64_t lba, const void* data)
+{
+  assert(mutex_held(&bcache_lock), "buffer cache lock not held");
+
+  /* once the cache is full, the least recently used
+   * clean buffer is recycled for the new block. if
+   * everything is dirty, the cache grows beyond its
+   * limit and the flusher is asked to clean up. */
+  buffer_t* buf = NULL;
+  if (buffers >= BCACHE_MAX_BUFFERS)
+  {
+    buf = lru_tail;
+    while (buf && (buf->dirty || buf->writeback || buf->reading))
+      buf = buf->lru_prev;
+    if (buf == NULL)
+      writeback_wakeup();
+  }
+
+  if (buf)
+  {
+    lru_unlink(buf);
+    hash_unlink(buf);
+    evictions++;
+  }
+  else
+  {
+    buf = kmem_cache_alloc(&buffer_cache);
+    buffers++;
+  }
+
+  buf->bd = bd;
+  buf->lba = lba;
+  buf->dirty = false;
+  buf->writeback = false;
+  buf->reading = (data == NULL);
+  buf->valid = (data != NULL);
+  if (data)
+    memcpy(buf->data, data, BLOCK_SIZE);
+
+  const size_t bucket = bcache_bucket(bd, lba);
+  buf->hash_next = bcache_hash[bucket];
+  bcache_hash[bucket] = buf;
+  lru_push(buf);
+  return buf;
+}
+
+ssize_t bd_bread(fd_t* fd, void* buffer, size_t count, uint64_t lba)
+{
+  bd_t* bd = bd_get(fd);
+  if (bd == NULL)
+    return -ENOTBLK;
+  if (!bd->driver->bd_ops.readblk)
+    return -ENOTSUP;
+
+  char* dest = buffer;
+  size_t done = 0;
+  while (done < count)
+  {
+    mutex_lock(&bcache_lock);
+    buffer_t* buf = bcache_lookup(bd, lba + done);
+    if (buf && !buf->valid)
+    {
+      /* someone else is reading the block */
+      mutex_unlock(&bcache_lock);
+      yield();
+      continue;
+    }
+    if (buf)
+    {
+      hits++;
+      memcpy(dest + done * BLOCK_SIZE, buf->data, BLOCK_SIZE);
+      lru_unlink(buf);
+      lru_push(buf);
+      mutex_unlock(&bcache_lock);
+      done++;
+      continue;
+    }
+
+    /* collect a run of missing blocks, which is
+     * read from the device with a single request.
+     * their buffers are inserted right away. */
+    size_t run = 1;
+    while (done + run < count && run < BCACHE_RUN_MAX &&
+           !bcache_lookup(bd, lba + done + run))
+      run++;
+    for (size_t i = 0; i < run; i++)
+      bcache_insert(bd, lba + done + i, NULL);
+    misses += run;
+    mutex_unlock(&bcache_lock);
+
+    /* the device is accessed without the cache lock
+     * held, the blocks are read straight into the
+     * caller's buffer and copied into the cache. */
+    char* run_buffer = dest + done * BLOCK_SIZE;
+    ssize_t blks = bd->driver->bd_ops.readblk(bd->data, bd->minor,
+          run_buffer, run, lba + done);
+    const int failed = blks < (ssize_t)run;
+
+    /* blocks which have been written in the meantime
+     * keep the new data, and the caller gets it too.
+     * if the read failed, the other buffers go away. */
+    mutex_lock(&bcache_lock);
+    for (size_t i = 0; i < run; i++)
+    {
+      buf = bcache_lookup(bd, lba + done + i);
+      assert(buf && buf->reading, "buffer recycled during read");
+      buf->reading = false;
+      if (buf->valid)
+      {
+        memcpy(run_buffer + i * BLOCK_SIZE, buf->data, BLOCK_SIZE);
+      }
+      else if (!failed)
+      {
+        memcpy(buf->data, run_buffer + i * BLOCK_SIZE, BLOCK_SIZE);
+        buf->valid = true;
+      }
+      else
+      {
+        lru_unlink(buf);
+        hash_unlink(buf);
+        kmem_free(buf);
+        buffers--;
+      }
+    }
+    mutex_unlock(&bcache_lock);
+
+    if (failed)
+      return blks < 0 ? blks : -EIO;
+    done += run;
+  }
+
+  return count;
+}
+
+ssize_t bd_bwrite(fd_t* fd, const void* buffer, size_t count, uint64_t lba)
+{
+  bd_t* bd = bd_get(fd);
+  if (bd == NULL)
+    return -ENOTBLK;
+  if (!bd->driver->bd_ops.writeblk)
+    return -ENOTSUP;
+
+  const char* src = buffer;
+  mutex_lock(&bcache_lock);
+  for (size_t i = 0; i < count; i++)
+  {
+    buffer_t* buf = bcache_lookup(bd, lba + i);
+    if (buf)
+    {
+      memcpy(buf->data, src + i * BLOCK_SIZE, BLOCK_SIZE);
+      buf->valid = true;
+      lru_unlink(buf);
+      lru_push(buf);
+    }
+    else
+    {
+      buf = bcache_insert(bd, lba + i, src + i * BLOCK_SIZE);
+    }
+
+    if (!buf->dirty)
+    {
+      buf->dirty = true;
+      buf->dirtied = ticks();
+      dirty_buffers++;
+    }
+  }
+  mutex_unlock(&bcache_lock);
+
+  if (dirty_buffers > DIRTY_BACKGROUND_BUFFERS)
+    writeback_wakeup();
+  return count;
+}
+
+void bcache_update(bd_t* bd, const void* buffer, size_t count, uint64_t lba)
+{
+  /* raw writes go straight to the device, cached copies
+   * of the written blocks are updated in place. */
+  const char* src = buffer;
+  mutex_lock(&bcache_lock);
+  for (size_t i = 0; i < count; i++)
+  {
+    buffer_t* buf = bcache_lookup(bd, lba + i);
+    if (buf)
+    {
+      memcpy(buf->data, src + i * BLOCK_SIZE, BLOCK_SIZE);
+      buf->valid = true;
+      if (buf->dirty)
+      {
+        buf->dirty = false;
+        dirty_buffers--;
+      }
+    }
+  }
+  mutex_unlock(&bcache_lock);
+}
+
+static int bkey_less(const bkey_t* a, const bkey_t* b)
+{
+  if (a->bd != b->bd)
+    return (size_t)a->bd < (size_t)b->bd;
+  return a->lba < b->lba;
+}
+
+static void bkey_sort(bkey_t* keys, size_t count)
+{
+  /* shell sort, no recursion on the kernel stack */
+  for (size_t gap = count / 2; gap > 0; gap /= 2)
+  {
+    for (size_t i = gap; i < count; i++)
+    {
+      const bkey_t key = keys[i];
+      size_t j = i;
+      while (j >= gap && bkey_less(&key, &keys[j - gap]))
+      {
+        keys[j] = keys[j - gap];
+        j -= gap;
+      }
+      keys[j] = key;
+    }
+  }
+}
+
+int bcache_flush(size_t min_age)
+{
+  /* collect the dirty buffers that are old enough and
+   * sort them, so that consecutive blocks can be merged
+   * into a single request. */
+  mutex_lock(&bcache_lock);
+  const size_t dirty = dirty_buffers;
+  if (dirty == 0)
+  {
+    mutex_unlock(&bcache_lock);
+    return SUCCESS;
+  }
+
+  bkey_t* keys = kmalloc(dirty * sizeof(bkey_t));
+  const size_t now = ticks();
+  size_t count = 0;
+  for (buffer_t* buf = lru_head; buf && count < dirty; buf = buf->lru_next)
+  {
+    if (buf->dirty && now - buf->dirtied >= min_age)
+    {
+      keys[count].bd = buf->bd;
+      keys[count].lba = buf->lba;
+      count++;
+    }
+  }
+  mutex_unlock(&bcache_lock);
+
+  bkey_sort(keys, count);
+
+  int error = SUCCESS;
+  char* bounce = kmalloc(BCACHE_RUN_MAX * BLOCK_SIZE);
+  size_t i = 0;
+  while (i < count)
+  {
+    /* copy a run of consecutive dirty blocks and mark
+     * them clean, so that they can be dirtied again while
+     * they are written. buffers which have been cleaned or
+     * recycled in the meantime end the run. */
+    bd_t* bd = keys[i].bd;
+    const uint64_t lba = keys[i].lba;
+    size_t run = 0;
+    mutex_lock(&bcache_lock);
+    while (i < count && run < BCACHE_RUN_MAX &&
+           keys[i].bd == bd && keys[i].lba == lba + run)
+    {
+      buffer_t* buf = bcache_lookup(bd, keys[i].lba);
+      if (buf == NULL || !buf->dirty)
+        break;
+      memcpy(bounce + run * BLOCK_SIZE, buf->data, BLOCK_SIZE);
+      buf->dirty = false;
+      buf->writeback = true;
+      dirty_buffers--;
+      run++;
+      i++;
+    }
+    mutex_unlock(&bcache_lock);
+
+    if (run == 0)
+    {
+      i++;
+      continue;
+    }
+
+    ssize_t blks = bd->driver->bd_ops.writeblk(bd->data, bd->minor,
+          bounce, run, lba);
+    const int failed = blks < (ssize_t)run;
+
+    /* buffers which couldn't be written are dirty
+     * again and will be retried later on. */
+    mutex_lock(&bcache_lock);
+    for (size_t b = 0; b < run; b++)
+    {
+      buffer_t* buf = bcache_lookup(bd, lba + b);
+      assert(buf && buf->writeback, "buffer recycled during write-back");
+      buf->writeback = false;
+      if (failed && !buf->dirty)
+      {
+        buf->dirty = true;
+        dirty_buffers++;
+      }
+    }
+    if (failed)
+      bd->wb_error = -EIO;
+    mutex_unlock(&bcache_lock);
+
+    if (failed)
+    {
+      debug(BLKDEV, "%s: write-back of blocks %zu-%zu failed\n",
+            bd->name, lba, lba + run - 1);
+      write_errors++;
+      error = -EIO;
+      continue;
+    }
+    flushed_buffers += run;
+    flush_requests++;
+  }
+
+  kfree(bounce);
+  kfree(keys);
+  return error;
+}
+
+int bcache_error()
+{
+  /* report and clear the write-back errors of all
+   * devices which have happened since the last call */
+  int error = SUCCESS;
+  mutex_lock(&bcache_lock);
+  mutex_lock(&bd_list_lock);
+  for (list_item_t* it = list_it_front(&bd_list);
+       it != LIST_IT_END;
+       it = list_it_next(it))
+  {
+    bd_t* bd = list_it_get(it);
+    if (bd->wb_error < 0)
+      error = bd->wb_error;
+    bd->wb_error = SUCCESS;
+  }
+  mutex_unlock(&bd_list_lock);
+  mutex_unlock(&bcache_lock);
+  return error;
+}
+
+size_t bcache_dirty()
+{
+  return dirty_buffers;
+}
+
+void bcache_print()
+{
+  const unsigned loglevel = BLKDEV|OUTPUT_ENABLED;
+  debug(loglevel, "-- buffer cache: %zu buffers (%zu KiB), %zu hits, "
+        "%zu misses, %zu evictions\n", buffers,
+        buffers * BLOCK_SIZE >> 10, hits, misses, evictions);
+  debug(loglevel, "   write-back: %zu dirty, %zu blocks written in "
+        "%zu requests, %zu errors\n", dirty_buffers, flushed_buffers,
+        flush_requests, write_errors);
+}
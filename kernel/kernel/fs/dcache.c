@@ -0,0 +1,207 @@
+/*
+ * UlmerOS dentry cache
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * path lookups go through a global hash table of dentries,
+ * keyed by (directory, name). a directory's list of entries
+ * is only scanned when the name is not in the cache, and
+ * the result is cached either way: names that do not exist
+ * get a negative entry, so that repeated failed lookups
+ * don't scan the directory over and over again. negative
+ * entries are limited in number and recycled in FIFO order,
+ * positive ones live as long as their directory. negative
+ * entries come from a cache of their own, with room for
+ * the longest possible name, so they can be recycled.
+ *
+ * lookups don't take any lock. dentries are never freed,
+ * negative ones are recycled as negative ones, so a reader
+ * never touches anything but a dentry. the worst that can
+ * happen is that a concurrent writer sends the reader down
+ * the wrong hash chain, which the sequence count catches.
+ * writers are serialized by the dcache lock.
+ */
+
+#include <fs/dcache.h>
+#include <sched/mutex.h>
+#include <sched/seqlock.h>
+#include <util/string.h>
+#include <mm/slab.h>
+#include <mm/memory.h>
+#include <debug.h>
+
+static direntry_t* dcache[DCACHE_BUCKETS];
+static mutex_t dcache_lock = MUTEX_INITIALIZER;
+static seqcount_t dcache_seq = SEQCOUNT_INITIALIZER;
+
+/* negative entries, recycled round-robin */
+static kmem_cache_t negative_cache = KMEM_CACHE_INITIALIZER(
+    "direntry_t-negative", sizeof(direntry_t) + DENTRY_NAME_MAX + 1);
+static direntry_t* negatives[DCACHE_NEGATIVE_MAX];
+static size_t negative_count = 0;
+static size_t negative_next = 0;
+
+/* statistics, updated without locking by lookups */
+static size_t hashed = 0;
+static size_t hits = 0;
+static size_t negative_hits = 0;
+static size_t misses = 0;
+
+uint32_t dcache_hash(dir_t* dir, const char* name)
+{
+  /* FNV-1a over the name, seeded with the directory */
+  uint32_t hash = 2166136261u ^ (uint32_t)((size_t)dir >> 4);
+  for (; *name; name++)
+  {
+    hash ^= (uint8_t)*name;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static direntry_t** dcache_bucket(uint32_t hash)
+{
+  return &dcache[hash % DCACHE_BUCKETS];
+}
+
+static direntry_t* dcache_find(dir_t* dir, const char* name, uint32_t hash)
+{
+  for (direntry_t* dentry = *dcache_bucket(hash);
+       dentry != NULL; dentry = dentry->hash_next)
+  {
+    if (dentry->hash == hash && dentry->parent == dir &&
+        strcmp(dentry->name, name) == 0)
+      return dentry;
+  }
+  return NULL;
+}
+
+static void dcache_hash_add(direntry_t* dentry)
+{
+  direntry_t** bucket = dcache_bucket(dentry->hash);
+  dentry->hash_next = *bucket;
+  *bucket = dentry;
+  hashed++;
+}
+
+static void dcache_unhash(direntry_t* dentry)
+{
+  direntry_t** link = dcache_bucket(dentry->hash);
+  while (*link != dentry)
+    link = &(*link)->hash_next;
+  *link = dentry->hash_next;
+  dentry->hash_next = NULL;
+  hashed--;
+}
+
+direntry_t* dcache_lookup(dir_t* dir, const char* name)
+{
+  const uint32_t hash = dcache_hash(dir, name);
+
+  direntry_t* dentry = NULL;
+  int valid = false;
+  for (size_t retry = 0; retry < DCACHE_RETRIES && !valid; retry++)
+  {
+    const size_t seq = read_seqbegin(&dcache_seq);
+    dentry = dcache_find(dir, name, hash);
+    valid = !read_seqretry(&dcache_seq, seq);
+  }
+
+  /* too many writers, wait for them */
+  if (!valid)
+  {
+    mutex_lock(&dcache_lock);
+    dentry = dcache_find(dir, name, hash);
+    mutex_unlock(&dcache_lock);
+  }
+
+  if (dentry == NULL)
+    misses++;
+  else if (dentry->negative)
+    negative_hits++;
+  else
+    hits++;
+  return dentry;
+}
+
+void dcache_insert(dir_t* dir, direntry_t* dentry)
+{
+  assert(dentry->parent == dir, "dentry is not part of the directory");
+
+  mutex_lock(&dcache_lock);
+  assert(dcache_find(dir, dentry->name, dentry->hash) == NULL,
+         "dentry is cached already");
+  write_seqbegin(&dcache_seq);
+  dcache_hash_add(dentry);
+  write_seqend(&dcache_seq);
+  mutex_unlock(&dcache_lock);
+}
+
+void dcache_negative(dir_t* dir, const char* name)
+{
+  const uint32_t hash = dcache_hash(dir, name);
+
+  mutex_lock(&dcache_lock);
+  if (dcache_find(dir, name, hash))
+  {
+    mutex_unlock(&dcache_lock);
+    return;
+  }
+
+  /* recycle the oldest negative entry once
+   * there are too many of them. */
+  direntry_t* dentry;
+  if (negative_count < DCACHE_NEGATIVE_MAX)
+  {
+    dentry = kmem_cache_alloc(&negative_cache);
+    dentry->parent = NULL;
+    negatives[negative_count++] = dentry;
+  }
+  else
+  {
+    dentry = negatives[negative_next];
+    negative_next = (negative_next + 1) % DCACHE_NEGATIVE_MAX;
+  }
+
+  write_seqbegin(&dcache_seq);
+  if (dentry->parent)
+    dcache_unhash(dentry);
+
+  const size_t name_length = strlen(name);
+  memcpy(dentry->name, name, name_length + 1);
+  dentry->name_length = name_length;
+  dentry->inode = 0;
+  dentry->file = NULL;
+  dentry->dir_next = NULL;
+  dentry->parent = dir;
+  dentry->hash = hash;
+  dentry->negative = true;
+  dcache_hash_add(dentry);
+  write_seqend(&dcache_seq);
+  mutex_unlock(&dcache_lock);
+}
+
+void dcache_forget(dir_t* dir, const char* name)
+{
+  const uint32_t hash = dcache_hash(dir, name);
+
+  mutex_lock(&dcache_lock);
+  direntry_t* dentry = dcache_find(dir, name, hash);
+  if (dentry && dentry->negative)
+  {
+    /* readers might still look at the entry, so it
+     * is not freed but left for reuse. */
+    write_seqbegin(&dcache_seq);
+    dcache_unhash(dentry);
+    dentry->parent = NULL;
+    write_seqend(&dcache_seq);
+  }
+  mutex_unlock(&dcache_lock);
+}
+
+void dcache_print()
+{
+  const unsigned loglevel = VFS|OUTPUT_ENABLED;
+  debug(loglevel, "-- dentry cache: %zu dentries (%zu negative), "
+        "%zu hits, %zu negative hits, %zu misses\n", hashed,
+        negative_count, hits, negative_hits, misses);
+}
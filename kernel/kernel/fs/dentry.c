@@ -0,0 +1,98 @@
+/*
+ * UlmerOS directory entries
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * dentries are allocated with their exact size, with the
+ * name stored inline right behind the header, so a short
+ * name only takes one small kmalloc() object. the entries
+ * of a directory are kept in a hash table which grows with
+ * the directory, chained through the dentries themselves.
+ */
+
+#include <fs/vfs.h>
+#include <fs/dcache.h>
+#include <util/string.h>
+#include <mm/memory.h>
+#include <debug.h>
+
+#define DIR_TABLE_MIN   8
+
+direntry_t* dentry_alloc(const char* name, size_t name_length)
+{
+  assert(name_length <= DENTRY_NAME_MAX, "dentry name too long");
+
+  direntry_t* dentry = kmalloc(sizeof(direntry_t) + name_length + 1);
+  dentry->file = NULL;
+  dentry->inode = 0;
+  dentry->parent = NULL;
+  dentry->hash_next = NULL;
+  dentry->dir_next = NULL;
+  dentry->hash = 0;
+  dentry->negative = false;
+  dentry->name_length = name_length;
+  memcpy(dentry->name, name, name_length);
+  dentry->name[name_length] = 0;
+  return dentry;
+}
+
+void dir_init(dir_t* dir)
+{
+  dir->entries = NULL;
+  dir->entries_size = 0;
+  dir->entry_count = 0;
+  dir->loaded = 0;
+  dir->complete = true;
+  mutex_init(&dir->lock);
+}
+
+static void dir_grow(dir_t* dir)
+{
+  const size_t size = max(DIR_TABLE_MIN, dir->entries_size * 2);
+  direntry_t** entries = kmalloc(size * sizeof(direntry_t*));
+  memset(entries, 0, size * sizeof(direntry_t*));
+
+  for (size_t i = 0; i < dir->entries_size; i++)
+  {
+    direntry_t* dentry = dir->entries[i];
+    while (dentry != NULL)
+    {
+      direntry_t* next = dentry->dir_next;
+      dentry->dir_next = entries[dentry->hash % size];
+      entries[dentry->hash % size] = dentry;
+      dentry = next;
+    }
+  }
+
+  if (dir->entries)
+    kfree(dir->entries);
+  dir->entries = entries;
+  dir->entries_size = size;
+}
+
+void dir_add(dir_t* dir, direntry_t* dentry)
+{
+  if (dir->entry_count >= dir->entries_size)
+    dir_grow(dir);
+
+  dentry->parent = dir;
+  dentry->hash = dcache_hash(dir, dentry->name);
+  direntry_t** bucket = &dir->entries[dentry->hash % dir->entries_size];
+  dentry->dir_next = *bucket;
+  *bucket = dentry;
+  dir->entry_count++;
+}
+
+direntry_t* dir_lookup(dir_t* dir, const char* name)
+{
+  if (dir->entry_count == 0)
+    return NULL;
+
+  const uint32_t hash = dcache_hash(dir, name);
+  for (direntry_t* dentry = dir->entries[hash % dir->entries_size];
+       dentry != NULL; dentry = dentry->dir_next)
+  {
+    if (dentry->hash == hash && strcmp(dentry->name, name) == 0)
+      return dentry;
+  }
+  return NULL;
+}
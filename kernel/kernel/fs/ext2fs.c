@@ -1,10 +1,13 @@
 #include <util/types.h>
 #include <sched/mutex.h>
+#include <sched/seqlock.h>
 #include <util/list.h>
 #include <util/string.h>
 #include <sched/task.h>
 #include <mm/memory.h>
 #include <fs/vfs.h>
+#include <fs/blockdev.h>
+#include <fs/ext2fs.h>
 #include <debug.h>
 #include <errno.h>
 
@@ -18,6 +21,16 @@
 #define EXT2_TIND_BLOCK   (EXT2_DIND_BLOCK + 1)
 #define EXT2_N_BLOCKS     (EXT2_TIND_BLOCK + 1)
 
+#define EXT2_GOOD_OLD_REV         0
+#define EXT2_GOOD_OLD_FIRST_INO   11
+#define EXT2_GOOD_OLD_INODE_SIZE  128
+
+#define EXT2_FEATURE_INCOMPAT_FILETYPE  BIT(1)
+#define EXT2_FT_REG_FILE                1
+
+#define EXT2_DENTRY_LEN(name_len) \
+  ((sizeof(ext2_dentry_base_t) + (name_len) + 3) & ~3ul)
+
 typedef struct
 {
   // base fields
@@ -143,27 +156,89 @@ typedef struct
   uint8_t   type; // feature dependent
 } __attribute__((packed)) ext2_dentry_base_t;
 
+/* a run of file blocks which are stored in consecutive
+ * disk blocks. holes are extents starting at block 0. */
 typedef struct
+{
+  size_t index;
+  size_t block;
+  size_t count;
+} ext2_extent_t;
+
+#define EXT2_EXTENTS  8
+
+/* the in-memory inode, file_t::driver2 points to it.
+ * recently used mappings are kept in a small extent
+ * cache, which saves walking the indirect blocks. */
+typedef struct _ext2_node_struct
+{
+  ext2_inode_t inode;
+  size_t ino;
+
+  /* inode cache linkage. unreferenced inodes are
+   * kept on the LRU list until they are evicted. */
+  size_t refcount;
+  struct _ext2_node_struct* hash_next;
+  struct _ext2_node_struct* lru_prev;
+  struct _ext2_node_struct* lru_next;
+
+  /* the mapping generation changes whenever the block
+   * mapping does, walks which started on an older one
+   * are not cached. */
+  mutex_t extent_lock;
+  ext2_extent_t extents[EXT2_EXTENTS];
+  size_t extent_count;
+  size_t extent_next;
+  size_t map_gen;
+} ext2_node_t;
+
+#define EXT2_ICACHE_BUCKETS  128
+#define EXT2_ICACHE_MAX      1024
+
+typedef struct _ext2fs_struct
 {
   ext2_superblock_t sb;
   fd_t* fd;
   dir_t* root;
   size_t block_size;
+  size_t block_lbas;
+  size_t inode_size;
+  size_t first_ino;
   size_t gd_count;
+  size_t gdt_lba;
+  size_t gdt_lba_size;
   ext2_gd_t* group_descriptors;
-  mutex_t io_lock;
+
+  /* protects inodes, the group descriptors, the
+   * bitmaps and the superblock counters */
   mutex_t fs_lock;
+
+  /* inode cache, protected by fs_lock as well.
+   * inode_buffer holds an inode table block. */
+  ext2_node_t* icache[EXT2_ICACHE_BUCKETS];
+  ext2_node_t* icache_lru;
+  ext2_node_t* icache_mru;
+  char* inode_buffer;
+  size_t icache_count;
+  size_t icache_hits;
+  size_t icache_misses;
+  size_t icache_evictions;
+
+  /* write statistics */
+  size_t bytes_written;
+  size_t blocks_allocated;
+  size_t alloc_runs;
+
+  struct _ext2fs_struct* next;
 } ext2fs_t;
 
+/* metadata (group descriptors, inode tables, indirect
+ * blocks, directories) is read through the buffer cache */
 static int ext2_get_block(ext2fs_t* fs,
     void* buffer, size_t lba, size_t count)
 {
-  ssize_t error;
-  mutex_lock(&fs->io_lock);
-  vfs_seek(fs->fd, lba * BLOCK_SIZE, SEEK_SET);
-  error = vfs_read(fs->fd, buffer, count * BLOCK_SIZE);
-  mutex_unlock(&fs->io_lock);
-  if (error < count * BLOCK_SIZE)
+  ssize_t error = bd_bread(fs->fd, buffer, count, lba);
+  if (error < 0)
   {
     debug(EXT2FS, "ext2 I/O error: %s\n", strerror(-error));
     return false;
@@ -171,6 +246,51 @@ static int ext2_get_block(ext2fs_t* fs,
   return true;
 }
 
+/* metadata is written to the buffer cache, which
+ * writes it back to the disk later on. */
+static int ext2_put_block(ext2fs_t* fs,
+    const void* buffer, size_t lba, size_t count)
+{
+  ssize_t error = bd_bwrite(fs->fd, buffer, count, lba);
+  if (error < 0)
+  {
+    debug(EXT2FS, "ext2 I/O error: %s\n", strerror(-error));
+    return false;
+  }
+  return true;
+}
+
+/* file data is cached in the page cache already, so it
+ * bypasses the buffer cache and goes to the device. */
+static int ext2_get_data(ext2fs_t* fs,
+    void* buffer, size_t lba, size_t count)
+{
+  ssize_t error = vfs_pread(fs->fd, buffer,
+        count * BLOCK_SIZE, lba * BLOCK_SIZE);
+  if (error < (ssize_t)(count * BLOCK_SIZE))
+  {
+    debug(EXT2FS, "ext2 I/O error: %s\n", strerror(-error));
+    return false;
+  }
+  return true;
+}
+
+static int ext2_put_data(ext2fs_t* fs,
+    const void* buffer, size_t lba, size_t count)
+{
+  ssize_t error = vfs_pwrite(fs->fd, (void*)buffer,
+        count * BLOCK_SIZE, lba * BLOCK_SIZE);
+  if (error < (ssize_t)(count * BLOCK_SIZE))
+  {
+    debug(EXT2FS, "ext2 I/O error: %s\n", strerror(-error));
+    return false;
+  }
+  return true;
+}
+
+static ext2fs_t* fs_list = NULL;
+static mutex_t fs_list_lock = MUTEX_INITIALIZER;
+
 static void* ext2_probe(fd_t* fd)
 {
   ssize_t error;
@@ -189,11 +309,31 @@ static void* ext2_probe(fd_t* fd)
 
   ext2fs_t* fs = kmalloc(sizeof(ext2fs_t));
   mutex_init(&fs->fs_lock);
-  mutex_init(&fs->io_lock);
   fs->root = NULL;
   fs->fd = vfs_dup(fd);
   fs->sb = sb;
   fs->block_size = 0x400 << fs->sb.block_size_log;
+  fs->block_lbas = fs->block_size / LBA_SIZE;
+  fs->bytes_written = 0;
+  fs->blocks_allocated = 0;
+  fs->alloc_runs = 0;
+  memset(fs->icache, 0, sizeof(fs->icache));
+  fs->icache_lru = NULL;
+  fs->icache_mru = NULL;
+  fs->icache_count = 0;
+  fs->icache_hits = 0;
+  fs->icache_misses = 0;
+  fs->icache_evictions = 0;
+  if (fs->sb.major_version == EXT2_GOOD_OLD_REV)
+  {
+    fs->inode_size = EXT2_GOOD_OLD_INODE_SIZE;
+    fs->first_ino = EXT2_GOOD_OLD_FIRST_INO;
+  }
+  else
+  {
+    fs->inode_size = fs->sb.inode_size;
+    fs->first_ino = fs->sb.first_inode_non_reserved;
+  }
   fs->gd_count = fs->sb.total_blocks / fs->sb.blocks_per_group;
   if (fs->sb.total_blocks % fs->sb.blocks_per_group)
     fs->gd_count += 1;
@@ -205,6 +345,8 @@ static void* ext2_probe(fd_t* fd)
   if (gdt_size % LBA_SIZE != 0)
       gdt_lba_size += 1;
 
+  fs->gdt_lba = gdt_lba;
+  fs->gdt_lba_size = gdt_lba_size;
   fs->group_descriptors = kmalloc(gdt_lba_size * LBA_SIZE);
   if (!ext2_get_block(fs, fs->group_descriptors, gdt_lba, gdt_lba_size))
   {
@@ -212,67 +354,309 @@ static void* ext2_probe(fd_t* fd)
     kfree(fs);
     return NULL;
   }
+  fs->inode_buffer = kmalloc(fs->block_size);
 
+  mutex_lock(&fs_list_lock);
+  fs->next = fs_list;
+  fs_list = fs;
+  mutex_unlock(&fs_list_lock);
   return fs;
 }
 
-static int fetch_inode(ext2fs_t* fs, size_t inode_no, ext2_inode_t* inode)
+static ext2_node_t* ext2_node_alloc()
+{
+  ext2_node_t* node = kmalloc(sizeof(ext2_node_t));
+  memset(node, 0, sizeof(ext2_node_t));
+  mutex_init(&node->extent_lock);
+  return node;
+}
+
+static ext2_node_t** icache_bucket(ext2fs_t* fs, size_t inode_no)
+{
+  return &fs->icache[inode_no % EXT2_ICACHE_BUCKETS];
+}
+
+static ext2_node_t* icache_lookup(ext2fs_t* fs, size_t inode_no)
+{
+  for (ext2_node_t* node = *icache_bucket(fs, inode_no);
+       node != NULL; node = node->hash_next)
+  {
+    if (node->ino == inode_no)
+      return node;
+  }
+  return NULL;
+}
+
+static void icache_lru_unlink(ext2fs_t* fs, ext2_node_t* node)
+{
+  if (node->lru_prev)
+    node->lru_prev->lru_next = node->lru_next;
+  else
+    fs->icache_lru = node->lru_next;
+  if (node->lru_next)
+    node->lru_next->lru_prev = node->lru_prev;
+  else
+    fs->icache_mru = node->lru_prev;
+  node->lru_prev = NULL;
+  node->lru_next = NULL;
+}
+
+static void icache_lru_push(ext2fs_t* fs, ext2_node_t* node)
+{
+  node->lru_next = NULL;
+  node->lru_prev = fs->icache_mru;
+  if (fs->icache_mru)
+    fs->icache_mru->lru_next = node;
+  else
+    fs->icache_lru = node;
+  fs->icache_mru = node;
+}
+
+static void icache_evict(ext2fs_t* fs)
+{
+  /* unreferenced inodes are dropped in LRU order. they
+   * are never dirty, store_inode() writes them through
+   * to the buffer cache. */
+  while (fs->icache_count > EXT2_ICACHE_MAX && fs->icache_lru)
+  {
+    ext2_node_t* node = fs->icache_lru;
+    icache_lru_unlink(fs, node);
+
+    ext2_node_t** link = icache_bucket(fs, node->ino);
+    while (*link != node)
+      link = &(*link)->hash_next;
+    *link = node->hash_next;
+
+    kfree(node);
+    fs->icache_count--;
+    fs->icache_evictions++;
+  }
+}
+
+static int icache_fill(ext2fs_t* fs, size_t inode_no)
+{
+  /* read the whole inode table block which contains
+   * the inode, and cache all the inodes in it. */
+  const size_t ipg = fs->sb.inodes_per_group;
+  const size_t group_no = (inode_no - 1) / ipg;
+  const ext2_gd_t* group = fs->group_descriptors + group_no;
+  const size_t inodes_per_block = fs->block_size / fs->inode_size;
+  const size_t index = (inode_no - 1) % ipg;
+  const size_t first = index - index % inodes_per_block;
+  const size_t block = group->bg_inode_table + first / inodes_per_block;
+
+  debug(EXT2FS, "fetching inodes %zu-%zu\n", group_no * ipg + first + 1,
+        group_no * ipg + first + inodes_per_block);
+  if (!ext2_get_block(fs, fs->inode_buffer,
+        block * fs->block_lbas, fs->block_lbas))
+    return -EIO;
+
+  for (size_t i = 0; i < inodes_per_block && first + i < ipg; i++)
+  {
+    const size_t ino = group_no * ipg + first + i + 1;
+    if (ino > fs->sb.total_inodes)
+      break;
+
+    /* a cached inode is at least as recent */
+    if (icache_lookup(fs, ino))
+      continue;
+
+    ext2_node_t* node = ext2_node_alloc();
+    node->inode = *(ext2_inode_t*)(fs->inode_buffer + i * fs->inode_size);
+    node->ino = ino;
+
+    ext2_node_t** bucket = icache_bucket(fs, ino);
+    node->hash_next = *bucket;
+    *bucket = node;
+    icache_lru_push(fs, node);
+    fs->icache_count++;
+  }
+  return SUCCESS;
+}
+
+static int ext2_iget(ext2fs_t* fs, size_t inode_no, ext2_node_t** result)
 {
   assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
 
   /* check if inode_no value is plausible */
-  if (inode_no > fs->sb.total_inodes)
+  if (inode_no == 0 || inode_no > fs->sb.total_inodes)
     return -ENOENT;
-  debug(EXT2FS, "fetching inode %zd\n", inode_no);
 
-  /* calculate the block in which the inode resides */
-  const size_t group_no = (inode_no - 1) / fs->sb.inodes_per_group;
-  const ext2_gd_t* group = fs->group_descriptors + group_no;
-  const size_t inode_size = (fs->sb.major_version < 1) ?
-        128 : fs->sb.inode_size;
-  const size_t inodes_per_sector = LBA_SIZE / inode_size;
-  const size_t lba_offset = ((inode_no - 1) %
-    fs->sb.inodes_per_group) / inodes_per_sector;
-  const size_t itable_lba = lba_offset +
-      (group->bg_inode_table * fs->block_size / LBA_SIZE);
-
-  /* fetch the corresponding sector from memory */
-  char* buffer = kmalloc(LBA_SIZE);
-  if (!ext2_get_block(fs, buffer, itable_lba, 1))
-  {
-    kfree(buffer);
-    return -EIO;
+  ext2_node_t* node = icache_lookup(fs, inode_no);
+  if (node)
+  {
+    fs->icache_hits++;
+  }
+  else
+  {
+    int error;
+    fs->icache_misses++;
+    if ((error = icache_fill(fs, inode_no)) < 0)
+      return error;
+    node = icache_lookup(fs, inode_no);
+    assert(node, "inode missing after fill");
   }
 
-  // copy the inode into the heap
-  // TODO: cache the inode, keep it in memory
-  const size_t buffer_index = ((inode_no - 1) % inodes_per_sector);
-  const ext2_inode_t* inode_ptr = (ext2_inode_t*)buffer + buffer_index;
-  *inode = *inode_ptr;
+  if (node->refcount++ == 0)
+    icache_lru_unlink(fs, node);
+  icache_evict(fs);
 
-  kfree(buffer);
+  *result = node;
   return SUCCESS;
 }
 
-static size_t ext2_get_file_block(
-    ext2fs_t* fs, ext2_inode_t* inode, char* block_buffer, size_t index)
+static void ext2_iput(ext2fs_t* fs, ext2_node_t* node)
 {
-  const size_t ptrs_per_block = fs->block_size / sizeof(uint32_t);
-  const size_t block_lba_size = fs->block_size / LBA_SIZE;
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+  assert(node->refcount > 0, "inode is not referenced");
 
-  if (index < 12)
-    return inode->i_block[index];
+  if (--node->refcount == 0)
+  {
+    icache_lru_push(fs, node);
+    icache_evict(fs);
+  }
+}
+
+static int store_inode(ext2fs_t* fs, ext2_node_t* node)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
 
-  if (index < 12 + ptrs_per_block)
+  /* calculate the sector in which the inode resides */
+  const size_t group_no = (node->ino - 1) / fs->sb.inodes_per_group;
+  const ext2_gd_t* group = fs->group_descriptors + group_no;
+  const size_t inodes_per_sector = LBA_SIZE / fs->inode_size;
+  const size_t index = (node->ino - 1) % fs->sb.inodes_per_group;
+  const size_t lba = index / inodes_per_sector
+        + group->bg_inode_table * fs->block_lbas;
+  const size_t offset = (index % inodes_per_sector) * fs->inode_size;
+
+  /* only the fields known to the driver are replaced,
+   * the rest of a large inode is left untouched. */
+  if (!ext2_get_block(fs, fs->inode_buffer, lba, 1))
+    return -EIO;
+  *(ext2_inode_t*)(fs->inode_buffer + offset) = node->inode;
+  if (!ext2_put_block(fs, fs->inode_buffer, lba, 1))
+    return -EIO;
+  return SUCCESS;
+}
+
+static ssize_t ext2_map_walk(ext2fs_t* fs, ext2_inode_t* inode,
+    size_t index, size_t* block, uint32_t* table)
+{
+  /* find the block behind the file's block index and the
+   * number of blocks following it, which are either
+   * contiguous on the disk or all part of a hole. */
+  const size_t ptrs = fs->block_size / sizeof(uint32_t);
+  size_t rel = index;
+  size_t n = EXT2_NDIR_BLOCKS;
+
+  /* the inode is packed, so the direct blocks are
+   * scanned from a copy. */
+  if (index < EXT2_NDIR_BLOCKS)
   {
-    if (!ext2_get_block(fs, block_buffer,
-          inode->i_block[12] * block_lba_size, block_lba_size))
-      return (size_t)-1;
-    return *((uint32_t*)block_buffer + (index - 12));
+    memcpy(table, inode->i_block, sizeof(uint32_t) * EXT2_NDIR_BLOCKS);
   }
+  else
+  {
+    /* find the level of indirection first. span is
+     * the number of blocks below the top table. */
+    size_t level = 0;
+    size_t span = ptrs;
+    rel = index - EXT2_NDIR_BLOCKS;
+    while (rel >= span)
+    {
+      rel -= span;
+      span *= ptrs;
+      if (++level > 2)
+        return -EFBIG;
+    }
 
-  kpanic(false, "ext2fs: indirect pointers are unimplemented");
-  return 0;
+    /* walk down to the last table. a missing table
+     * is a hole which spans its whole range. */
+    size_t next = inode->i_block[EXT2_IND_BLOCK + level];
+    for (;;)
+    {
+      if (next == 0)
+      {
+        *block = 0;
+        return span - rel;
+      }
+      if (!ext2_get_block(fs, table, next * fs->block_lbas, fs->block_lbas))
+        return -EIO;
+
+      span /= ptrs;
+      if (span == 1)
+        break;
+      next = table[rel / span];
+      rel %= span;
+    }
+    n = ptrs;
+  }
+
+  *block = table[rel];
+  size_t count = 1;
+  while (rel + count < n)
+  {
+    const size_t next = table[rel + count];
+    if ((*block == 0) ? (next != 0) : (next != *block + count))
+      break;
+    count++;
+  }
+  return count;
+}
+
+static ssize_t ext2_map(ext2fs_t* fs, ext2_node_t* node,
+    size_t index, size_t* block, void* block_buffer)
+{
+  /* returns the number of blocks of the extent which
+   * contains the index, starting from the index. */
+  mutex_lock(&node->extent_lock);
+  for (size_t i = 0; i < node->extent_count; i++)
+  {
+    const ext2_extent_t* e = &node->extents[i];
+    if (index >= e->index && index < e->index + e->count)
+    {
+      *block = e->block ? e->block + (index - e->index) : 0;
+      mutex_unlock(&node->extent_lock);
+      return e->index + e->count - index;
+    }
+  }
+  const size_t gen = node->map_gen;
+  mutex_unlock(&node->extent_lock);
+
+  /* readers walk the mapping without fs_lock, so it
+   * might be changed while they do. */
+  ssize_t count = ext2_map_walk(fs, &node->inode, index, block, block_buffer);
+  mutex_lock(&node->extent_lock);
+  if (count > 0 && gen == node->map_gen)
+  {
+    ext2_extent_t* e;
+    if (node->extent_count < EXT2_EXTENTS)
+    {
+      e = &node->extents[node->extent_count++];
+    }
+    else
+    {
+      e = &node->extents[node->extent_next];
+      node->extent_next = (node->extent_next + 1) % EXT2_EXTENTS;
+    }
+    e->index = index;
+    e->block = *block;
+    e->count = count;
+  }
+  mutex_unlock(&node->extent_lock);
+  return count;
+}
+
+static void ext2_unmap(ext2_node_t* node)
+{
+  /* drop the extent cache after the block mapping of
+   * the inode has been changed. */
+  mutex_lock(&node->extent_lock);
+  node->extent_count = 0;
+  node->extent_next = 0;
+  node->map_gen++;
+  mutex_unlock(&node->extent_lock);
 }
 
 static ssize_t ext2_read(void* drvdata,
@@ -280,9 +664,11 @@ static ssize_t ext2_read(void* drvdata,
 {
   file_t* file = drvdata;
   ext2fs_t* fs = file->driver1;
-  ext2_inode_t* inode = file->driver2;
+  ext2_node_t* node = file->driver2;
 
   /* truncate length if necessary */
+  if (offset >= file->length)
+    return 0;
   if (offset + len > file->length)
     len = file->length - offset;
 
@@ -291,81 +677,661 @@ static ssize_t ext2_read(void* drvdata,
         (len < 1024) ? len : len >> 10,
         (len < 1024) ? "B" : "K");
 
+  /* only regular file contents are data, anything
+   * else is read through the buffer cache */
+  int (*get_block)(ext2fs_t*, void*, size_t, size_t) =
+        (file->type == F_REGULAR) ? ext2_get_data : ext2_get_block;
+
+  const size_t bs = fs->block_size;
   int error = SUCCESS;
   size_t bytes_read = 0;
-  char* block_buffer = kmalloc(fs->block_size);
+  char* block_buffer = kmalloc(bs);
   while (bytes_read < len)
   {
-    const size_t current_block = (offset + bytes_read) / fs->block_size;
-    const size_t block_no = ext2_get_file_block(fs, inode, block_buffer, current_block);
-    const size_t block_lba = block_no * fs->block_size / LBA_SIZE;
-    const size_t block_lba_size = fs->block_size / LBA_SIZE;
+    const uint64_t pos = offset + bytes_read;
+    const size_t bb_offset = pos % bs;
 
-    if (!ext2_get_block(fs, block_buffer, block_lba, block_lba_size))
+    size_t block;
+    ssize_t extent = ext2_map(fs, node, pos / bs, &block, block_buffer);
+    if (extent < 0)
     {
-      error = -EIO;
+      error = extent;
       break;
     }
 
-    size_t bb_offset = 0;
-    if (bytes_read == 0)
-      bb_offset = offset % fs->block_size;
-
-    size_t cpy_size = fs->block_size - bb_offset;
-    if (bytes_read + cpy_size > len)
-      cpy_size -= bytes_read + cpy_size - len;
-
-    /* copy data into the user buffer */
-    memcpy(buffer + bytes_read, block_buffer + bb_offset, cpy_size);
+    size_t cpy_size = min(len - bytes_read, extent * bs - bb_offset);
+    if (block == 0)
+    {
+      /* holes are read as zeros */
+      memset(buffer + bytes_read, 0, cpy_size);
+    }
+    else if (bb_offset == 0 && cpy_size >= bs)
+    {
+      /* whole blocks of an extent are read straight
+       * into the buffer with a single request. */
+      cpy_size -= cpy_size % bs;
+      if (!get_block(fs, buffer + bytes_read,
+            block * fs->block_lbas, cpy_size / bs * fs->block_lbas))
+      {
+        error = -EIO;
+        break;
+      }
+    }
+    else
+    {
+      cpy_size = min(cpy_size, bs - bb_offset);
+      if (!get_block(fs, block_buffer, block * fs->block_lbas, fs->block_lbas))
+      {
+        error = -EIO;
+        break;
+      }
+      memcpy(buffer + bytes_read, block_buffer + bb_offset, cpy_size);
+    }
     bytes_read += cpy_size;
   }
   kfree(block_buffer);
 
-  if (error != SUCCESS)
+  if (error != SUCCESS && bytes_read == 0)
     return error;
   return bytes_read;
 }
 
+static int ext2_sync_counters(ext2fs_t* fs)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  /* the driver only knows a part of the superblock, so
+   * the free counters are patched into the on-disk copy. */
+  ext2_superblock_t* sb = kmalloc(SB_SIZE * LBA_SIZE);
+  int error = -EIO;
+  if (ext2_get_block(fs, sb, SB_LBA, SB_SIZE))
+  {
+    sb->unalloc_blocks = fs->sb.unalloc_blocks;
+    sb->unalloc_inodes = fs->sb.unalloc_inodes;
+    if (ext2_put_block(fs, sb, SB_LBA, SB_SIZE) &&
+        ext2_put_block(fs, fs->group_descriptors,
+                       fs->gdt_lba, fs->gdt_lba_size))
+      error = SUCCESS;
+  }
+
+  kfree(sb);
+  return error;
+}
+
+static size_t group_size(ext2fs_t* fs, size_t group)
+{
+  /* the last group might be smaller than the others */
+  const size_t first = fs->sb.superblock + group * fs->sb.blocks_per_group;
+  return min(fs->sb.blocks_per_group, fs->sb.total_blocks - first);
+}
+
+static size_t find_free_run(const uint8_t* bitmap, size_t size,
+    size_t start, size_t count, int whole, size_t* first)
+{
+  /* find the first run of clear bits at or after start.
+   * if whole is set, the run must hold count bits. */
+  size_t i = start;
+  while (i < size)
+  {
+    if (bitmap[i / 8] & (1 << (i % 8)))
+    {
+      i++;
+      continue;
+    }
+
+    size_t run = 1;
+    while (run < count && i + run < size &&
+           !(bitmap[(i + run) / 8] & (1 << ((i + run) % 8))))
+      run++;
+
+    if (!whole || run == count)
+    {
+      *first = i;
+      return run;
+    }
+    i += run;
+  }
+  return 0;
+}
+
+static size_t ext2_alloc_blocks(ext2fs_t* fs,
+    size_t goal, size_t count, size_t* block)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  const size_t first_data = fs->sb.superblock;
+  const size_t bpg = fs->sb.blocks_per_group;
+  if (goal < first_data || goal >= fs->sb.total_blocks)
+    goal = first_data;
+  const size_t goal_group = (goal - first_data) / bpg;
+
+  /* search the goal's group first, starting at the goal,
+   * then the following groups. the first pass only takes
+   * runs which hold the whole request, so that large
+   * writes stay contiguous. the second pass takes any
+   * free block that can be found. */
+  uint8_t* bitmap = kmalloc(fs->block_size);
+  size_t allocated = 0;
+  for (int pass = 0; pass < 2 && allocated == 0; pass++)
+  {
+    for (size_t i = 0; i < fs->gd_count && allocated == 0; i++)
+    {
+      const size_t group = (goal_group + i) % fs->gd_count;
+      ext2_gd_t* gd = fs->group_descriptors + group;
+      if (gd->bg_free_blocks_count < ((pass == 0) ? count : 1))
+        continue;
+      if (!ext2_get_block(fs, bitmap,
+            gd->bg_block_bitmap * fs->block_lbas, fs->block_lbas))
+        continue;
+
+      const size_t size = group_size(fs, group);
+      const size_t start = (i == 0) ? (goal - first_data) % bpg : 0;
+      size_t first = 0;
+      size_t run = find_free_run(bitmap, size, start, count, pass == 0, &first);
+      if (run == 0 && start > 0)
+        run = find_free_run(bitmap, size, 0, count, pass == 0, &first);
+      if (run == 0)
+        continue;
+
+      for (size_t bit = first; bit < first + run; bit++)
+        bitmap[bit / 8] |= 1 << (bit % 8);
+      if (!ext2_put_block(fs, bitmap,
+            gd->bg_block_bitmap * fs->block_lbas, fs->block_lbas))
+        continue;
+
+      gd->bg_free_blocks_count -= run;
+      fs->sb.unalloc_blocks -= run;
+      *block = first_data + group * bpg + first;
+      allocated = run;
+    }
+  }
+  kfree(bitmap);
+
+  if (allocated > 0)
+  {
+    fs->blocks_allocated += allocated;
+    fs->alloc_runs++;
+    debug(EXT2FS, "allocated blocks %zu-%zu (goal %zu)\n",
+          *block, *block + allocated - 1, goal);
+  }
+  return allocated;
+}
+
+static size_t ext2_alloc_inode(ext2fs_t* fs, size_t goal_group)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  const size_t ipg = fs->sb.inodes_per_group;
+  uint8_t* bitmap = kmalloc(fs->block_size);
+  size_t inode_no = 0;
+  for (size_t i = 0; i < fs->gd_count && inode_no == 0; i++)
+  {
+    const size_t group = (goal_group + i) % fs->gd_count;
+    ext2_gd_t* gd = fs->group_descriptors + group;
+    if (gd->bg_free_inodes_count == 0)
+      continue;
+    if (!ext2_get_block(fs, bitmap,
+          gd->bg_inode_bitmap * fs->block_lbas, fs->block_lbas))
+      continue;
+
+    /* reserved inodes are never handed out */
+    for (size_t bit = 0; bit < ipg; bit++)
+    {
+      if (bitmap[bit / 8] & (1 << (bit % 8)))
+        continue;
+      if (group * ipg + bit + 1 < fs->first_ino)
+        continue;
+
+      bitmap[bit / 8] |= 1 << (bit % 8);
+      if (!ext2_put_block(fs, bitmap,
+            gd->bg_inode_bitmap * fs->block_lbas, fs->block_lbas))
+        break;
+
+      gd->bg_free_inodes_count--;
+      fs->sb.unalloc_inodes--;
+      inode_no = group * ipg + bit + 1;
+      break;
+    }
+  }
+
+  kfree(bitmap);
+  return inode_no;
+}
+
+static int ext2_free_inode(ext2fs_t* fs, size_t inode_no)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  /* give back an inode which ext2_alloc_inode() handed
+   * out, the counters are synced by the caller. */
+  const size_t ipg = fs->sb.inodes_per_group;
+  const size_t bit = (inode_no - 1) % ipg;
+  ext2_gd_t* gd = fs->group_descriptors + (inode_no - 1) / ipg;
+
+  uint8_t* bitmap = kmalloc(fs->block_size);
+  int error = -EIO;
+  if (ext2_get_block(fs, bitmap,
+        gd->bg_inode_bitmap * fs->block_lbas, fs->block_lbas))
+  {
+    error = SUCCESS;
+    if (bitmap[bit / 8] & (1 << (bit % 8)))
+    {
+      bitmap[bit / 8] &= ~(1 << (bit % 8));
+      if (ext2_put_block(fs, bitmap,
+            gd->bg_inode_bitmap * fs->block_lbas, fs->block_lbas))
+      {
+        gd->bg_free_inodes_count++;
+        fs->sb.unalloc_inodes++;
+      }
+      else
+      {
+        error = -EIO;
+      }
+    }
+  }
+
+  kfree(bitmap);
+  return error;
+}
+
+static int ext2_new_table(ext2fs_t* fs, size_t goal, size_t* table)
+{
+  /* indirect blocks are allocated next to the
+   * data they point to. */
+  if (ext2_alloc_blocks(fs, goal, 1, table) == 0)
+    return -ENOSPC;
+
+  char* zero = kmalloc(fs->block_size);
+  memset(zero, 0, fs->block_size);
+  int error = SUCCESS;
+  if (!ext2_put_block(fs, zero, *table * fs->block_lbas, fs->block_lbas))
+    error = -EIO;
+  kfree(zero);
+  return error;
+}
+
+static int ext2_set_block(ext2fs_t* fs, ext2_inode_t* inode,
+    size_t index, size_t block, uint32_t* table)
+{
+  if (index < EXT2_NDIR_BLOCKS)
+  {
+    inode->i_block[index] = block;
+    return SUCCESS;
+  }
+
+  const size_t ptrs = fs->block_size / sizeof(uint32_t);
+  size_t level = 0;
+  size_t span = ptrs;
+  size_t rel = index - EXT2_NDIR_BLOCKS;
+  while (rel >= span)
+  {
+    rel -= span;
+    span *= ptrs;
+    if (++level > 2)
+      return -EFBIG;
+  }
+
+  int error;
+  size_t current = inode->i_block[EXT2_IND_BLOCK + level];
+  if (current == 0)
+  {
+    if ((error = ext2_new_table(fs, block, &current)) < 0)
+      return error;
+    inode->i_block[EXT2_IND_BLOCK + level] = current;
+    inode->i_blocks += fs->block_lbas;
+  }
+
+  /* walk down the tables, missing ones are
+   * allocated on the way. */
+  for (;;)
+  {
+    if (!ext2_get_block(fs, table, current * fs->block_lbas, fs->block_lbas))
+      return -EIO;
+
+    span /= ptrs;
+    const size_t entry = rel / span;
+    rel %= span;
+    if (span == 1)
+    {
+      table[entry] = block;
+      break;
+    }
+
+    size_t next = table[entry];
+    if (next == 0)
+    {
+      if ((error = ext2_new_table(fs, block, &next)) < 0)
+        return error;
+      inode->i_blocks += fs->block_lbas;
+      table[entry] = next;
+      if (!ext2_put_block(fs, table, current * fs->block_lbas, fs->block_lbas))
+        return -EIO;
+    }
+    current = next;
+  }
+
+  if (!ext2_put_block(fs, table, current * fs->block_lbas, fs->block_lbas))
+    return -EIO;
+  return SUCCESS;
+}
+
+static int ext2_map_blocks(ext2fs_t* fs, ext2_node_t* node,
+    size_t index, size_t block, size_t count)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  int error = SUCCESS;
+  uint32_t* table = kmalloc(fs->block_size);
+  for (size_t i = 0; i < count && error == SUCCESS; i++)
+    error = ext2_set_block(fs, &node->inode, index + i, block + i, table);
+  kfree(table);
+
+  ext2_unmap(node);
+  return error;
+}
+
+static size_t ext2_goal(ext2fs_t* fs, file_t* file,
+    ext2_node_t* node, char* block_buffer, size_t index)
+{
+  /* new blocks are placed right behind the previous
+   * block of the file, or at the start of the block
+   * group of the inode. */
+  size_t prev;
+  if (index > 0 && ext2_map(fs, node, index - 1, &prev, block_buffer) > 0
+      && prev != 0)
+    return prev + 1;
+
+  const size_t group = (file->inode - 1) / fs->sb.inodes_per_group;
+  return fs->sb.superblock + group * fs->sb.blocks_per_group;
+}
+
+static ssize_t ext2_write_blocks(ext2fs_t* fs, file_t* file,
+    const char* buffer, size_t len, uint64_t offset, size_t index,
+    size_t block, size_t count, int fresh, char* block_buffer)
+{
+  /* write the part of [offset, offset + len) which falls
+   * into the count blocks starting at the file's block
+   * index, which are stored at block on the disk. whole
+   * blocks are written straight from the buffer, partial
+   * ones are merged with what is already on the disk. */
+  const size_t bs = fs->block_size;
+  int (*get_block)(ext2fs_t*, void*, size_t, size_t) =
+        (file->type == F_REGULAR) ? ext2_get_data : ext2_get_block;
+  int (*put_block)(ext2fs_t*, const void*, size_t, size_t) =
+        (file->type == F_REGULAR) ? ext2_put_data : ext2_put_block;
+
+  size_t b = 0;
+  while (b < count)
+  {
+    const uint64_t bstart = (uint64_t)(index + b) * bs;
+    const uint64_t lo = max(offset, bstart);
+    const uint64_t hi = min(offset + len, bstart + bs);
+
+    if (lo == bstart && hi == bstart + bs)
+    {
+      size_t full = 1;
+      while (b + full < count && offset + len >= bstart + (full + 1) * bs)
+        full++;
+      if (!put_block(fs, buffer + (lo - offset),
+            (block + b) * fs->block_lbas, full * fs->block_lbas))
+        return -EIO;
+      b += full;
+      continue;
+    }
+
+    if (fresh)
+      memset(block_buffer, 0, bs);
+    else if (!get_block(fs, block_buffer,
+          (block + b) * fs->block_lbas, fs->block_lbas))
+      return -EIO;
+
+    memcpy(block_buffer + (lo - bstart), buffer + (lo - offset), hi - lo);
+    if (!put_block(fs, block_buffer,
+          (block + b) * fs->block_lbas, fs->block_lbas))
+      return -EIO;
+    b++;
+  }
+  return SUCCESS;
+}
+
+static ssize_t ext2_write_file(ext2fs_t* fs, file_t* file,
+    const void* buffer, size_t len, uint64_t offset)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  ext2_node_t* node = file->driver2;
+  ext2_inode_t* inode = &node->inode;
+  if (len == 0)
+    return 0;
+
+  /* i_size only has 32 bits */
+  const size_t bs = fs->block_size;
+  const size_t ptrs = bs / sizeof(uint32_t);
+  const size_t first = offset / bs;
+  const size_t last = (offset + len - 1) / bs;
+  if (offset + len > 0xffffffffu ||
+      last >= EXT2_NDIR_BLOCKS + ptrs + ptrs * ptrs + ptrs * ptrs * ptrs)
+    return -EFBIG;
+
+  debug(EXT2FS, "write: inode %zd, off=0x%zx, size=%zd%s\n",
+        file->inode, offset,
+        (len < 1024) ? len : len >> 10,
+        (len < 1024) ? "B" : "K");
+
+  int error = SUCCESS;
+  int allocated = false;
+  char* block_buffer = kmalloc(bs);
+  size_t index = first;
+  while (index <= last)
+  {
+    size_t block;
+    ssize_t extent = ext2_map(fs, node, index, &block, block_buffer);
+    if (extent < 0)
+    {
+      error = extent;
+      break;
+    }
+
+    /* extents are written with a single request */
+    size_t count = min((size_t)extent, last - index + 1);
+    const int fresh = (block == 0);
+    if (fresh)
+    {
+      /* blocks are allocated when data is written back,
+       * for the whole hole at once. */
+      const size_t goal = ext2_goal(fs, file, node, block_buffer, index);
+      count = ext2_alloc_blocks(fs, goal, count, &block);
+      if (count == 0)
+      {
+        error = -ENOSPC;
+        break;
+      }
+      allocated = true;
+
+      if ((error = ext2_map_blocks(fs, node, index, block, count)) < 0)
+        break;
+      inode->i_blocks += count * fs->block_lbas;
+    }
+
+    if ((error = ext2_write_blocks(fs, file, buffer, len, offset,
+          index, block, count, fresh, block_buffer)) < 0)
+      break;
+    index += count;
+  }
+  kfree(block_buffer);
+
+  /* whatever has been written so far counts */
+  const uint64_t end = min(offset + len, (uint64_t)index * bs);
+  if (index > first && end > inode->i_size)
+  {
+    inode->i_size = end;
+    if (end > file->length)
+      file->length = end;
+  }
+  if (index > first)
+    fs->bytes_written += end - offset;
+
+  int store_error = store_inode(fs, node);
+  if (allocated && ext2_sync_counters(fs) < 0)
+    store_error = -EIO;
+
+  if (index == first)
+    return error;
+  if (store_error < 0)
+    return store_error;
+  return end - offset;
+}
+
 static ssize_t ext2_write(void* drvdata,
                          void* buffer, size_t len, uint64_t offset)
 {
-  return -ENOSYS;
+  file_t* file = drvdata;
+  ext2fs_t* fs = file->driver1;
+
+  mutex_lock(&fs->fs_lock);
+  ssize_t written = ext2_write_file(fs, file, buffer, len, offset);
+  mutex_unlock(&fs->fs_lock);
+  return written;
+}
+
+static int ext2_add_dentry(ext2fs_t* fs, file_t* dfile,
+    const char* name, size_t inode_no)
+{
+  assert(mutex_held(&fs->fs_lock), "fs_lock not acquired");
+
+  const size_t bs = fs->block_size;
+  const size_t name_len = strlen(name);
+  const size_t needed = EXT2_DENTRY_LEN(name_len);
+  const uint8_t type = (fs->sb.required_features &
+        EXT2_FEATURE_INCOMPAT_FILETYPE) ? EXT2_FT_REG_FILE : 0;
+
+  /* look for a record with enough slack to split off
+   * the new entry. if there is none, the directory
+   * grows by a block. */
+  char* block = kmalloc(bs);
+  uint64_t offset;
+  ext2_dentry_base_t* dentry = NULL;
+  for (offset = 0; offset < dfile->length && !dentry; offset += bs)
+  {
+    if (ext2_read(dfile, block, bs, offset) < (ssize_t)bs)
+    {
+      kfree(block);
+      return -EIO;
+    }
+
+    size_t pos = 0;
+    while (pos < bs)
+    {
+      ext2_dentry_base_t* current = (ext2_dentry_base_t*)(block + pos);
+      if (current->size == 0)
+        break;
+
+      const size_t used = current->inode ?
+            EXT2_DENTRY_LEN(current->name_length) : 0;
+      if (current->size - used >= needed)
+      {
+        dentry = (ext2_dentry_base_t*)(block + pos + used);
+        dentry->size = current->size - used;
+        if (used)
+          current->size = used;
+        break;
+      }
+      pos += current->size;
+    }
+  }
+
+  if (dentry)
+  {
+    offset -= bs;
+  }
+  else
+  {
+    memset(block, 0, bs);
+    dentry = (ext2_dentry_base_t*)block;
+    dentry->size = bs;
+    offset = dfile->length;
+  }
+
+  dentry->inode = inode_no;
+  dentry->name_length = name_len;
+  dentry->type = type;
+  memcpy(dentry + 1, name, name_len);
+
+  ssize_t written = ext2_write_file(fs, dfile, block, bs, offset);
+  kfree(block);
+  return (written < 0) ? written : SUCCESS;
 }
 
 static void ext2_fetch_dir(file_t* dfile, dir_t* dir)
 {
+  /* nothing is read yet, see ext2_lookup() */
   dir->file = dfile;
-  list_init(&dir->files);
+  dir_init(dir);
+  dir->complete = (dfile->length == 0);
   dir->mounted = NULL;
   dir->driver = dfile->driver1;
+}
+
+static int ext2_lookup(dir_t* dir, const char* name, direntry_t** dentry)
+{
+  assert(mutex_held(&dir->lock), "directory lock not acquired");
 
-  char* buffer = kmalloc(dfile->length);
-  ext2_read(dfile, buffer, dfile->length, 0);
+  /* directories are loaded block by block, until the
+   * block which contains the name. all entries of the
+   * loaded blocks are kept, except for the ones which
+   * have been created in memory already. */
+  file_t* dfile = dir->file;
+  ext2fs_t* fs = dfile->driver1;
+  const size_t bs = fs->block_size;
 
-  list_clear(&dir->files);
-  size_t index = 0;
-  while (index < dfile->length)
+  int error = SUCCESS;
+  char* block = kmalloc(bs);
+  direntry_t* found = NULL;
+  while (found == NULL && dir->loaded < dfile->length)
   {
-    ext2_dentry_base_t* direntry =
-        (ext2_dentry_base_t*)(buffer + index);
-    index += direntry->size;
+    if (ext2_read(dfile, block, bs, dir->loaded) < (ssize_t)bs)
+    {
+      /* the directory stays incomplete, so
+       * the block is read again next time */
+      debug(EXT2FS, "cannot read directory inode %zu\n", dfile->inode);
+      error = -EIO;
+      break;
+    }
+    dir->loaded += bs;
 
-    if (direntry->inode != 0)
+    size_t pos = 0;
+    while (pos + sizeof(ext2_dentry_base_t) <= bs)
     {
-      direntry_t* dentry = kmalloc(sizeof(direntry_t));
+      ext2_dentry_base_t* direntry = (ext2_dentry_base_t*)(block + pos);
+      if (direntry->size < sizeof(ext2_dentry_base_t) ||
+          pos + direntry->size > bs)
+        break;
+      pos += direntry->size;
 
-      // copy the name and fetch the inode
-      char* name = (char*)(direntry + 1);
-      strncpy(dentry->name, name, direntry->name_length);
-      dentry->name[direntry->name_length] = 0;
-      list_add(&dir->files, dentry);
+      if (direntry->inode == 0 || direntry->name_length == 0 ||
+          sizeof(ext2_dentry_base_t) + direntry->name_length > direntry->size)
+        continue;
 
-      dentry->file = NULL;
-      dentry->inode = direntry->inode;
+      char entry_name[DENTRY_NAME_MAX + 1];
+      memcpy(entry_name, direntry + 1, direntry->name_length);
+      entry_name[direntry->name_length] = 0;
+      if (dir_lookup(dir, entry_name))
+        continue;
+
+      // copy the name, the inode is fetched later
+      direntry_t* entry = dentry_alloc(entry_name, direntry->name_length);
+      entry->inode = direntry->inode;
+      dir_add(dir, entry);
+      if (strcmp(entry_name, name) == 0)
+        found = entry;
     }
   }
+  kfree(block);
 
-  kfree(buffer);
+  if (dir->loaded >= dfile->length)
+    dir->complete = true;
+  *dentry = found;
+  return error;
 }
 
 static fs_t* my_fsinfo;
@@ -373,8 +1339,18 @@ static fs_t* my_fsinfo;
 static void ext2_fetch_file(ext2fs_t* fs, size_t inode_no, file_t* file)
 {
   mutex_lock(&fs->fs_lock);
-  ext2_inode_t* inode = kmalloc(sizeof(ext2_inode_t));
-  fetch_inode(fs, inode_no, inode);
+  ext2_node_t* node;
+  int error = ext2_iget(fs, inode_no, &node);
+  if (error < 0)
+  {
+    /* an unreadable inode shows up as an empty,
+     * uncached file. */
+    debug(EXT2FS, "cannot fetch inode %zu: %s\n", inode_no, strerror(-error));
+    node = ext2_node_alloc();
+    node->ino = inode_no;
+    node->refcount = 1;
+  }
+  ext2_inode_t* inode = &node->inode;
 
   file->type = inode->i_mode & 0xf000;
   uint16_t mode = inode->i_mode & 0x0fff;
@@ -387,7 +1363,8 @@ static void ext2_fetch_file(ext2fs_t* fs, size_t inode_no, file_t* file)
   file->length = inode->i_size;
   file->inode = inode_no;
   file->driver1 = fs;
-  file->driver2 = inode;
+  file->driver2 = node;
+  file->pcache = NULL;
 
   switch (file->type)
   {
@@ -417,15 +1394,89 @@ static void ext2_fetch(dir_t* dir, direntry_t* direntry)
   assert(direntry->file == NULL, "nothing to fetch, file already present");
 
   ext2fs_t* fs = dir->file->driver1;
-  direntry->file = kmalloc(sizeof(file_t));
-  ext2_fetch_file(fs, direntry->inode, direntry->file);
+  file_t* file = kmem_cache_alloc(&file_cache);
+  ext2_fetch_file(fs, direntry->inode, file);
+  file->parent = dir;
+
+  /* lookups see the file as soon as it is stored */
+  barrier();
+  direntry->file = file;
+}
+
+static int ext2_create(dir_t* parent, const char* name, file_t* file)
+{
+  /* only regular files are created on the disk. new
+   * directories and device nodes live in memory. */
+  if (file->type != F_REGULAR)
+    return SUCCESS;
+
+  ext2fs_t* fs = parent->file->driver1;
+  if (strlen(name) > 255)
+    return -ENAMETOOLONG;
+
+  mutex_lock(&fs->fs_lock);
+  const size_t group = (parent->file->inode - 1) / fs->sb.inodes_per_group;
+  const size_t inode_no = ext2_alloc_inode(fs, group);
+  if (inode_no == 0)
+  {
+    mutex_unlock(&fs->fs_lock);
+    return -ENOSPC;
+  }
+
+  /* the inode might still be cached from the time
+   * it was free, it is simply reinitialized. */
+  ext2_node_t* node;
+  int error = ext2_iget(fs, inode_no, &node);
+  if (error < 0)
+  {
+    ext2_free_inode(fs, inode_no);
+    ext2_sync_counters(fs);
+    mutex_unlock(&fs->fs_lock);
+    return error;
+  }
+  ext2_unmap(node);
+
+  ext2_inode_t* inode = &node->inode;
+  memset(inode, 0, sizeof(ext2_inode_t));
+  inode->i_mode = F_REGULAR | (*(uint16_t*)&file->mode & 0x0fff);
+  inode->i_uid = file->uid;
+  inode->i_gid = file->gid;
+  inode->i_atime = file->t_last_accessed;
+  inode->i_mtime = file->t_last_modified;
+  inode->i_ctime = file->t_created;
+  inode->i_links_count = 1;
+
+  /* the inode is given back if it can't be linked into
+   * the directory. once the dentry is on the disk, the
+   * inode is in use, even if the counters can't be
+   * written now (the next sync writes them). */
+  error = store_inode(fs, node);
+  if (error == SUCCESS)
+    error = ext2_add_dentry(fs, parent->file, name, inode_no);
+  if (error < 0)
+  {
+    ext2_iput(fs, node);
+    ext2_free_inode(fs, inode_no);
+  }
+  if (ext2_sync_counters(fs) < 0)
+    debug(EXT2FS, "cannot write the free counters\n");
+  mutex_unlock(&fs->fs_lock);
+
+  if (error < 0)
+    return error;
+
+  debug(EXT2FS, "created inode %zu: %s\n", inode_no, name);
+  file->inode = inode_no;
+  file->driver1 = fs;
+  file->driver2 = node;
+  return SUCCESS;
 }
 
 static dir_t* ext2_mount(void* drv)
 {
   ext2fs_t* fs = drv;
 
-  file_t* root = kmalloc(sizeof(file_t));
+  file_t* root = kmem_cache_alloc(&file_cache);
   ext2_fetch_file(fs, 2, root);
   assert(root->type == F_DIR, "root dir is not a directory");
 
@@ -437,6 +1488,8 @@ static fs_t ext2fs = {
   .probe = ext2_probe,
   .mount = ext2_mount,
   .fetch = ext2_fetch,
+  .lookup = ext2_lookup,
+  .create = ext2_create,
   .f_ops = {
     .read = ext2_read,
     .write = ext2_write,
@@ -444,6 +1497,27 @@ static fs_t ext2fs = {
   .mbr_id = 0x83,
 };
 
+void ext2fs_print()
+{
+  const unsigned loglevel = EXT2FS|OUTPUT_ENABLED;
+
+  mutex_lock(&fs_list_lock);
+  for (ext2fs_t* fs = fs_list; fs != NULL; fs = fs->next)
+  {
+    const size_t lookups = fs->icache_hits + fs->icache_misses;
+    debug(loglevel, "-- ext2 on %s: %zu cached inodes, %zu hits, "
+          "%zu misses (%zu%% hit rate), %zu evictions\n",
+          bd_get(fs->fd) ? bd_get(fs->fd)->name : "?", fs->icache_count,
+          fs->icache_hits, fs->icache_misses,
+          lookups ? fs->icache_hits * 100 / lookups : 0,
+          fs->icache_evictions);
+    debug(loglevel, "   %zu bytes written, %zu blocks allocated "
+          "in %zu runs\n", fs->bytes_written, fs->blocks_allocated,
+          fs->alloc_runs);
+  }
+  mutex_unlock(&fs_list_lock);
+}
+
 void ext2fs_init()
 {
   debug(EXT2FS, "initializing ext2 filesystem driver\n");
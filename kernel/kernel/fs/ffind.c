@@ -1,35 +1,124 @@
 #include <fs/vfs.h>
+#include <fs/dcache.h>
 #include <sched/mutex.h>
 #include <errno.h>
 #include <debug.h>
 #include <util/string.h>
 
-static mutex_t fs_tree_lock = MUTEX_INITIALIZER;
+/* path lookups don't take any global lock. names are
+ * resolved through the dentry cache, whose lookups are
+ * lock-free, and directory entries and files are never
+ * freed. a directory's lock is only taken on a dentry
+ * cache miss, to fetch one of its files from the disk
+ * and to create new entries. */
 
 static void fs_fetch(dir_t* parent, direntry_t* entry)
 {
-  if (entry->file != NULL)
-    return;
-  assert(parent->fstype, "no filesystem info in directory");
-  parent->fstype->fetch(parent, entry);
-  entry->file->parent = parent;
+  /* the disk I/O only blocks lookups which need the
+   * same directory. somebody else might have fetched
+   * the file already while we were waiting. */
+  mutex_lock(&parent->lock);
+  if (entry->file == NULL)
+  {
+    assert(parent->fstype, "no filesystem info in directory");
+    parent->fstype->fetch(parent, entry);
+  }
+  mutex_unlock(&parent->lock);
+}
+
+static int dir_scan(dir_t* dir, const char* name, direntry_t** entry)
+{
+  assert(mutex_held(&dir->lock), "directory lock not acquired");
+
+  /* the directory is only searched if the name is
+   * not in the dentry cache. the result is cached,
+   * even if the name does not exist, but only if the
+   * whole directory has been searched. */
+  *entry = dcache_lookup(dir, name);
+  if (*entry)
+  {
+    if ((*entry)->negative)
+      *entry = NULL;
+    return SUCCESS;
+  }
+
+  *entry = dir_lookup(dir, name);
+  if (*entry == NULL && !dir->complete)
+  {
+    int error = dir->fstype->lookup(dir, name, entry);
+    if (error < 0)
+      return error;
+  }
+
+  if (*entry)
+    dcache_insert(dir, *entry);
+  else if (dir->complete)
+    dcache_negative(dir, name);
+  return SUCCESS;
+}
+
+static int ffind_lookup(dir_t* dir, const char* name, direntry_t** entry)
+{
+  *entry = dcache_lookup(dir, name);
+  if (*entry)
+  {
+    if ((*entry)->negative)
+      *entry = NULL;
+    return SUCCESS;
+  }
+
+  mutex_lock(&dir->lock);
+  int error = dir_scan(dir, name, entry);
+  mutex_unlock(&dir->lock);
+  return error;
 }
 
-static int ffind_noent(dir_t* parent, int flags, file_t* new_file)
+static int ffind_noent(dir_t* parent, const char* name,
+                       int flags, file_t* new_file)
 {
   if ((flags & FFIND_CREATE) == 0)
     return -ENOENT;
 
-  list_add(&parent->files, new_file);
+  /* somebody else might have created it meanwhile */
+  mutex_lock(&parent->lock);
+  direntry_t* existing;
+  int error = dir_scan(parent, name, &existing);
+  if (error < 0 || existing)
+  {
+    mutex_unlock(&parent->lock);
+    return (error < 0) ? error : -EEXIST;
+  }
+
   new_file->parent = parent;
   new_file->driver1 = parent->file->driver1;
   new_file->driver2 = NULL;
-
   if (new_file->type == F_DIR)
   {
     new_file->special.directory->parent = parent;
     new_file->special.directory->driver = new_file->driver1;
   }
+
+  /* let the file system store the new file */
+  if (parent->fstype && parent->fstype->create)
+  {
+    error = parent->fstype->create(parent, name, new_file);
+    if (error < 0)
+    {
+      mutex_unlock(&parent->lock);
+      return error;
+    }
+  }
+
+  /* the dentry is complete before lookups can see it */
+  direntry_t* dentry = dentry_alloc(name, strlen(name));
+  dentry->inode = new_file->inode;
+  dentry->file = new_file;
+  dir_add(parent, dentry);
+
+  /* the name exists now */
+  dcache_forget(parent, name);
+  dcache_insert(parent, dentry);
+  mutex_unlock(&parent->lock);
   return SUCCESS;
 }
 
@@ -54,37 +143,32 @@ static int ffind_recursive(const char* pathname, dir_t* working_dir,
   if (working_dir->mounted != NULL)
     working_dir = working_dir->mounted;
 
-  if (list_size(&working_dir->files) == 0)
-    return ffind_noent(working_dir, flags, *node);
+  /* only the last path component can be created */
+  const int noent_flags = (*rem == 0) ? flags : 0;
+  direntry_t* entry;
+  int error = ffind_lookup(working_dir, current_name, &entry);
+  if (error < 0)
+    return error;
+  if (entry == NULL)
+    return ffind_noent(working_dir, current_name, noent_flags,
+                       node ? *node : NULL);
+
+  if (entry->file == NULL)
+    fs_fetch(working_dir, entry);
 
-  for (list_item_t* it = list_it_front(&working_dir->files);
-       it != LIST_IT_END;
-       it = list_it_next(it))
+  if (*rem == 0)
   {
-    direntry_t* entry = list_it_get(it);
+    if (*(rem - 1) == '/' && entry->file->type != F_DIR)
+      return -ENOTDIR;
 
-    if (strcmp(entry->name, current_name) == 0)
-    {
-      if (entry->file == NULL)
-        fs_fetch(working_dir, entry);
-
-      if (*rem == 0)
-      {
-        if (*(rem - 1) == '/' && entry->file->type != F_DIR)
-          return -ENOTDIR;
-
-        if (*node)
-          *node = entry->file;
-        return ffind_success(flags);
-      }
-
-      if (entry->file->type != F_DIR)
-        return ffind_noent(working_dir, flags, *node);
-      return ffind_recursive(rem, entry->file->special.directory, node, flags);
-    }
+    if (node)
+      *node = entry->file;
+    return ffind_success(flags);
   }
 
-  return ffind_noent(working_dir, flags, node ? *node : NULL);
+  if (entry->file->type != F_DIR)
+    return -ENOTDIR;
+  return ffind_recursive(rem, entry->file->special.directory, node, flags);
 }
 
 int ffind(dir_t* working_dir, const char* pathname, file_t** node, int flags)
@@ -94,18 +178,15 @@ int ffind(dir_t* working_dir, const char* pathname, file_t** node, int flags)
     pathname += 1;
     working_dir = VFS_ROOT;
 
-    if (pathname[1] == 0)
+    if (pathname[0] == 0)
     {
       if (flags & FFIND_CREATE)
         return -EEXIST;
-      if (*node)
+      if (node)
         *node = working_dir->file;
       return SUCCESS;
     }
   }
 
-  mutex_lock(&fs_tree_lock);
-  int ret = ffind_recursive(pathname, working_dir, node, flags);
-  mutex_unlock(&fs_tree_lock);
-  return ret;
+  return ffind_recursive(pathname, working_dir, node, flags);
 }
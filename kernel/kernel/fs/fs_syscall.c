@@ -1,4 +1,5 @@
 #include <fs/vfs.h>
+#include <mm/writeback.h>
 #include <sched/proc.h>
 #include <sched/task.h>
 #include <arch/common.h>
@@ -24,12 +25,12 @@ ssize_t sys_read(int fd, char* buffer, size_t len)
     return -EBADF;
 
   if (!fdp->f_ops.read)
-  {
-    mutex_unlock(&fdp->fdmod);
     return -ENOTSUP;
-  }
 
-  ssize_t ret = fdp->f_ops.read(fdp->fs_data, buffer, len, fdp->fpos);
+  mutex_lock(&fdp->fdmod);
+  ssize_t ret = vfs_pread(fdp, buffer, len, fdp->fpos);
+  if (ret > 0)
+    fdp->fpos += ret;
   mutex_unlock(&fdp->fdmod);
   return ret;
 }
@@ -52,12 +53,12 @@ ssize_t sys_write(int fd, char* buffer, size_t len)
     return -EBADF;
 
   if (!fdp->f_ops.write)
-  {
-    mutex_unlock(&fdp->fdmod);
     return -ENOTSUP;
-  }
 
-  ssize_t ret = fdp->f_ops.write(fdp->fs_data, buffer, len, fdp->fpos);
+  mutex_lock(&fdp->fdmod);
+  ssize_t ret = vfs_pwrite(fdp, buffer, len, fdp->fpos);
+  if (ret > 0)
+    fdp->fpos += ret;
   mutex_unlock(&fdp->fdmod);
   return ret;
 }
@@ -82,3 +83,23 @@ int sys_close(int fd)
 {
   return -ENOSYS;
 }
+
+int sys_fsync(int fd)
+{
+  assert(current_task && current_task->process,
+         "sys_fsync() called from kernel mode. use writeback_file()");
+
+  fd_t* fdp = proc_get_fd(current_task->process, fd);
+  if (fdp == NULL)
+    return -EBADF;
+
+  /* block devices only have dirty buffers */
+  if (fdp->file == NULL || fdp->file->type != F_REGULAR)
+    return writeback_sync();
+  return writeback_file(fdp->file);
+}
+
+int sys_sync()
+{
+  return writeback_sync();
+}
@@ -2,6 +2,7 @@
 #include <fs/blockdev.h>
 #include <mm/memory.h>
 #include <debug.h>
+#include <errno.h>
 #include <util/string.h>
 
 typedef struct
@@ -46,7 +47,14 @@ ssize_t ps_write(void* drv_struct, size_t minor,
 {
   (void)minor;
   part_t* part = ((part_t*)drv_struct);
-  return part->blkdev->driver->bd_ops.readblk(part->blkdev->data,
+  if (!part->blkdev->driver->bd_ops.writeblk)
+    return -ENOTSUP;
+
+  /* never write beyond the end of the partition */
+  if (lba >= part->blk_size)
+    return 0;
+  count = min(count, part->blk_size - lba);
+  return part->blkdev->driver->bd_ops.writeblk(part->blkdev->data,
            part->blkdev->minor, buffer, count, lba + part->blk_offset);
 }
 
@@ -27,25 +27,29 @@ static ssize_t initrd_read(void* drv, size_t minor,
 {
   rd_t* rd = drv;
 
+  if (lba >= rd->ramdisk_size)
+    return 0;
   if (lba + count > rd->ramdisk_size)
     count = rd->ramdisk_size - lba;
 
   memcpy(buffer, rd->ramdisk + lba * BLOCK_SIZE, count * BLOCK_SIZE);
-  return count * BLOCK_SIZE;
+  return count;
 }
 
 static ssize_t initrd_write(void* drv, size_t minor,
                             char* buffer, size_t count, uint64_t lba)
 {
   rd_t* rd = drv;
-  mutex_lock(&rd->rd_lock);
 
+  if (lba >= rd->ramdisk_size)
+    return 0;
   if (lba + count > rd->ramdisk_size)
     count = rd->ramdisk_size - lba;
 
+  mutex_lock(&rd->rd_lock);
   memcpy(rd->ramdisk + lba * BLOCK_SIZE, buffer, count * BLOCK_SIZE);
   mutex_unlock(&rd->rd_lock);
-  return count * BLOCK_SIZE;
+  return count;
 }
 
 static const char* initrd_get_prefix(void* drv)
@@ -77,15 +81,17 @@ bd_t* ramdisk_install(void *ramdisk, size_t ramdisk_size)
   rd->ramdisk = ramdisk;
   rd->ramdisk_size = ramdisk_size >> 9;
   rd->minor = atomic_add(&minor_counter, 1);
+  mutex_init(&rd->rd_lock);
 
   bd_t* bd = kmalloc(sizeof(bd_t));
-  bd->capacity = rd->ramdisk_size / BLOCK_SIZE;
+  bd->capacity = rd->ramdisk_size;
   bd->driver = &initrd_driver;
   bd->data = rd;
   bd->minor = rd->minor;
+  sprintf(bd->name, "rd%zu", rd->minor);
 
   debug(BLKDEV, "(%zu, %zu): installing ramdisk, size=%zu blocks\n",
-        initrd_major, rd->minor, rd->ramdisk_size / BLOCK_SIZE);
+        initrd_major, rd->minor, rd->ramdisk_size);
   bd_register(bd);
   return bd;
 }
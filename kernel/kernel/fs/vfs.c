@@ -1,10 +1,12 @@
 #include <fs/vfs.h>
 #include <fs/ramfs.h>
+#include <fs/ext2fs.h>
 #include <fs/blockdev.h>
 #include <util/string.h>
 #include <arch/common.h>
 #include <sched/task.h>
 #include <mm/memory.h>
+#include <mm/pagecache.h>
 #include <debug.h>
 #include <errno.h>
 #include <time.h>
@@ -20,13 +22,14 @@
 
 dir_t* _vfs_root;
 
+kmem_cache_t fd_cache = KMEM_CACHE_INITIALIZER("fd_t", sizeof(fd_t));
+kmem_cache_t file_cache = KMEM_CACHE_INITIALIZER("file_t", sizeof(file_t));
+
 static list_t fs_list;
 static mutex_t fs_list_lock;
 
 int vfs_initialized = false;
 
-extern void ext2fs_init();
-
 static void* probe_fs(fd_t* disk, fs_t** fs_)
 {
   mutex_lock(&fs_list_lock);
@@ -117,7 +120,7 @@ static dir_t* get_working_dir(proc_t* proc)
 static file_t* falloc(proc_t* proc, ftype_t type, fmode_t mode)
 {
   /* allocate a file structure with common defaults */
-  file_t* file = kmalloc(sizeof(file_t));
+  file_t* file = kmem_cache_alloc(&file_cache);
   file->mode = mode;
   file->uid = proc ? proc->uid : 0;
   file->gid = proc ? proc->gid : 0;
@@ -129,6 +132,7 @@ static file_t* falloc(proc_t* proc, ftype_t type, fmode_t mode)
       file->t_last_modified = time();
   file->type = type;
   file->length = 0;
+  file->pcache = NULL;
   return file;
 }
 
@@ -177,7 +181,7 @@ int vfs_mkdir(proc_t* proc, const char* pathname, fmode_t mode)
 
   dir_t* dir = kmalloc(sizeof(dir_t));
   dir->driver = NULL;
-  list_init(&dir->files);
+  dir_init(dir);
   dir->fstype = NULL;
   dir->mounted = NULL;
 
@@ -204,10 +208,37 @@ void fs_register(fs_t *fs)
 }
 
 ssize_t vfs_read(fd_t *fd, void *buffer, uint64_t length)
+{
+  return vfs_pread(fd, buffer, length, fd->fpos);
+}
+
+ssize_t vfs_pread(fd_t* fd, void* buffer, uint64_t length, uint64_t offset)
 {
   if (fd->f_ops.read == NULL)
     return -ENOTSUP;
-  return fd->f_ops.read(fd->fs_data, buffer, length, fd->fpos);
+
+  /* regular files are read through the page cache,
+   * the file system only sees the misses. */
+  if (fd->file && fd->file->type == F_REGULAR)
+    return pagecache_read(fd, buffer, length, offset);
+  return fd->f_ops.read(fd->fs_data, buffer, length, offset);
+}
+
+ssize_t vfs_write(fd_t* fd, void* buffer, uint64_t length)
+{
+  return vfs_pwrite(fd, buffer, length, fd->fpos);
+}
+
+ssize_t vfs_pwrite(fd_t* fd, void* buffer, uint64_t length, uint64_t offset)
+{
+  if (fd->f_ops.write == NULL)
+    return -ENOTSUP;
+
+  /* writes to regular files go to the page cache,
+   * which writes them back to the file system later. */
+  if (fd->file && fd->file->type == F_REGULAR)
+    return pagecache_write(fd, buffer, length, offset);
+  return fd->f_ops.write(fd->fs_data, buffer, length, offset);
 }
 
 uint64_t vfs_seek(fd_t *fd, uint64_t offset, int whence)
@@ -231,7 +262,16 @@ uint64_t vfs_seek(fd_t *fd, uint64_t offset, int whence)
 
 fd_t *vfs_dup(fd_t *fd)
 {
-  return fd;
+  /* the copy refers to the same file, but has its own
+   * position and lock, and is closed independently. */
+  fd_t* dup = kmem_cache_alloc(&fd_cache);
+  dup->file = fd->file;
+  dup->fpos = fd->fpos;
+  dup->f_ops = fd->f_ops;
+  dup->fs_data = fd->fs_data;
+  mutex_init(&dup->fdmod);
+  readahead_reset(&dup->ra);
+  return dup;
 }
 
 int vfs_open(const char *filename, int flags, int mode, fd_t** fd)
@@ -247,19 +287,36 @@ int vfs_open(const char *filename, int flags, int mode, fd_t** fd)
 
   int error;
   file_t* target;
-  if ((error = ffind(working_dir, filename, &target, 0)) < 0)
+  error = ffind(working_dir, filename, &target, 0);
+  if (error == -ENOENT && (flags & O_CREAT))
+  {
+    uint16_t mode_bits = mode & 0x0fff;
+    target = falloc(process, F_REGULAR, *(fmode_t*)&mode_bits);
+    error = ffind(working_dir, filename, &target, FFIND_CREATE);
+    if (error < 0)
+    {
+      kfree(target);
+
+      /* somebody else might have created it meanwhile */
+      if (error == -EEXIST)
+        error = ffind(working_dir, filename, &target, 0);
+    }
+  }
+  if (error < 0)
     return error;
 
   /* TODO: perform access control checks */
 
   if (target->type == F_REGULAR)
   {
-    *fd = kmalloc(sizeof(fd_t));
+    *fd = kmem_cache_alloc(&fd_cache);
     (*fd)->file = target;
     (*fd)->fpos = 0;
     assert(target->parent, "file_t has no parent!");
     (*fd)->f_ops = target->parent->fstype->f_ops;
     (*fd)->fs_data = target;
+    mutex_init(&(*fd)->fdmod);
+    readahead_reset(&(*fd)->ra);
     return SUCCESS;
   }
   else if (target->type == F_BLOCK)
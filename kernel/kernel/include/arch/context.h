@@ -23,3 +23,9 @@ void context_set_ret(context_t* ctx, size_t ret);
 
 context_t *context_init(void* kstack_ptr, void* entry_addr, void* stack_ptr,
                         int flags, size_t arg0, size_t arg1);
+
+/* copy the user mode context saved at the top of the
+ * kernel stack parent_kstack_ptr to the top of another
+ * kernel stack. used to let a forked task continue at the
+ * same place as its parent. */
+context_t* context_fork(void* kstack_ptr, void* parent_kstack_ptr);
@@ -27,6 +27,7 @@ typedef struct
   bd_driver_t* driver;       // driver structure
   void* data;
   char name[32];
+  int wb_error;       // sticky write-back error, see bcache_error()
 } bd_t;
 
 void blockdev_init();
@@ -36,6 +37,37 @@ int bd_get_by_name(const char* name, size_t* major, size_t* minor);
 
 int bd_open(fd_t** fd_, size_t major, size_t minor);
 
+/* get the block device behind an fd, or NULL if
+ * the fd does not refer to a block device. */
+bd_t* bd_get(fd_t* fd);
+
+/* read count blocks starting at lba through the buffer
+ * cache. returns the number of blocks read. */
+ssize_t bd_bread(fd_t* fd, void* buffer, size_t count, uint64_t lba);
+
+/* write count blocks starting at lba into the buffer
+ * cache. the blocks are written to the device later on
+ * by the flusher. returns the number of blocks written. */
+ssize_t bd_bwrite(fd_t* fd, const void* buffer, size_t count, uint64_t lba);
+
+/* write back dirty buffers which have been dirty for at
+ * least min_age ticks, in (device, lba) order. */
+int bcache_flush(size_t min_age);
+
+/* return a write-back error of any device since
+ * the last call, so that fsync() can report it. */
+int bcache_error();
+
+/* number of dirty buffers in the cache */
+size_t bcache_dirty();
+
+/* update cached copies of blocks that have been
+ * written to the device directly. */
+void bcache_update(bd_t* bd, const void* buffer, size_t count, uint64_t lba);
+
+/* print buffer cache statistics */
+void bcache_print();
+
 size_t bd_register_driver(bd_driver_t* bd_driver);
 
 void bd_register(bd_t* blkdev);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <util/types.h>
+#include <fs/vfs.h>
+
+#define DCACHE_BUCKETS       1024
+#define DCACHE_NEGATIVE_MAX  256
+#define DCACHE_RETRIES       4
+
+/* hash of a name in a directory, also used
+ * by the directory tables */
+uint32_t dcache_hash(dir_t* dir, const char* name);
+
+/* look up a name in a directory without locking. returns
+ * the cached dentry, which may be negative, or NULL on a
+ * miss. dentries are never freed. */
+direntry_t* dcache_lookup(dir_t* dir, const char* name);
+
+/* add a dentry of the directory to the cache. this
+ * and the following are called with the directory
+ * lock held. */
+void dcache_insert(dir_t* dir, direntry_t* dentry);
+
+/* remember that a name does not exist in the directory */
+void dcache_negative(dir_t* dir, const char* name);
+
+/* drop the negative entry of a name that is about
+ * to be created, if there is one. */
+void dcache_forget(dir_t* dir, const char* name);
+
+/* print dentry cache statistics */
+void dcache_print();
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <util/types.h>
+
+/* register the ext2 filesystem driver */
+void ext2fs_init();
+
+/* print inode cache and write statistics
+ * of all ext2 filesystems */
+void ext2fs_print();
@@ -3,6 +3,7 @@
 #include <util/types.h>
 #include <util/list.h>
 #include <sched/mutex.h>
+#include <mm/slab.h>
 
 #define BLOCK_SIZE 512
 
@@ -60,19 +61,46 @@ typedef struct _dir_struct dir_t;
 struct _fd_struct;
 typedef struct _fd_struct fd_t;
 
+struct _pcache_struct;
+typedef struct _pcache_struct pcache_t;
+
+/* dentries are variable-length, the name is stored
+ * right behind the header. they are never freed. */
 typedef struct _dentry
 {
-  char name[256];
-  size_t inode;
   file_t *file;
+  size_t inode;
+
+  /* dentry cache and directory table linkage, see
+   * dcache.c. negative entries record names which
+   * do not exist and aren't part of any directory. */
+  dir_t* parent;
+  struct _dentry* hash_next;
+  struct _dentry* dir_next;
+  uint32_t hash;
+  uint8_t negative;
+  uint8_t name_length;
+  char name[];
 } direntry_t;
 
+#define DENTRY_NAME_MAX   255
+
 typedef struct
 {
   ssize_t (*read)(void* fsdata, void* buffer, size_t len, uint64_t off);
   ssize_t (*write)(void* fsdata, void* buffer, size_t len, uint64_t off);
 } f_ops_t;
 
+/* readahead state of an open file. all indices are
+ * page indices. see pagecache.c */
+typedef struct
+{
+  size_t start;       // first page of the current window
+  size_t size;        // window size, 0 if not sequential
+  size_t marker;      // reading this page starts the next window
+  size_t prev_index;  // last page read
+} readahead_t;
+
 struct _fd_struct
 {
   file_t* file;     // pointer to file object
@@ -82,12 +110,18 @@ struct _fd_struct
   void* fs_data;    // driver/filesystem data (bd_t, inode)
 
   mutex_t fdmod;    // modification lock
+  readahead_t ra;   // readahead state (regular files)
 };
 
 struct _dir_struct
 {
   file_t* file;   // file object of the directory
-  list_t files;  // list of direntries
+  direntry_t** entries;   // hash table of direntries
+  size_t entries_size;    // number of buckets
+  size_t entry_count;     // number of direntries
+  uint64_t loaded;        // bytes of the directory loaded so far
+  int complete;           // all entries are in the table
+  mutex_t lock;   // held to modify entries and fetch files
   dir_t* parent;  // parent directory (null if mount point)
   dir_t* mounted; // root directory if dir is mountpoint
   fs_t* fstype;   // file system type structure
@@ -122,6 +156,7 @@ struct _file_struct
   void* driver2;
   dir_t* parent;
   sp_file_u special;        // special file features
+  pcache_t* pcache;         // cached pages (regular files)
 };
 
 struct _fs_struct
@@ -130,7 +165,23 @@ struct _fs_struct
   uint8_t mbr_id;
   void* (*probe)(fd_t* fd);
   dir_t* (*mount)(void* fs);
+
+  /* load the file of a directory entry. called with the
+   * directory lock held. lookups don't lock, so the file
+   * must be complete (parent included) before it is
+   * stored in direntry->file. */
   void (*fetch)(dir_t* parent, direntry_t* direntry);
+
+  /* directories which aren't complete are loaded on
+   * demand. load entries until the name shows up and
+   * store its dentry, or NULL once the directory is
+   * complete. returns an error if the directory could
+   * not be read. called with the directory lock held. */
+  int (*lookup)(dir_t* dir, const char* name, direntry_t** dentry);
+
+  /* store a file that has been added to a directory
+   * of the file system. optional. */
+  int (*create)(dir_t* parent, const char* name, file_t* file);
   f_ops_t f_ops;
 };
 
@@ -140,16 +191,34 @@ typedef struct _proc_struct proc_t;
 extern dir_t* _vfs_root;
 #define VFS_ROOT (_vfs_root)
 
+/* slab caches for frequently allocated VFS objects */
+extern kmem_cache_t fd_cache;
+extern kmem_cache_t file_cache;
+
 void vfs_init(const char *rootfs);
 int ffind(dir_t* working_dir, const char* pathname, file_t** node, int flags);
 
 void fs_register(fs_t *fs);
 
+/* allocate a dentry for a name of the given length,
+ * which doesn't have to be null-terminated. */
+direntry_t* dentry_alloc(const char* name, size_t name_length);
+
+/* initialize an empty directory */
+void dir_init(dir_t* dir);
+
+/* add a dentry to a directory or look up a name in it.
+ * the directory lock must be held, unless nobody else
+ * can see the directory yet. */
+void dir_add(dir_t* dir, direntry_t* dentry);
+direntry_t* dir_lookup(dir_t* dir, const char* name);
+
 #define SEEK_SET	1
 #define SEEK_CUR	2
 #define SEEK_END	3
 
 #define O_RDONLY BIT(0)
+#define O_CREAT  BIT(6)
 
 #define FFIND_CREATE      BIT(0)
 
@@ -158,7 +227,19 @@ extern int vfs_initialized;
 int vfs_open(const char* filename, int flags, int mode, fd_t **fd);
 void vfs_close(fd_t* fd);
 ssize_t vfs_read(fd_t* fd, void* buffer, uint64_t length);
+
+/* read from the given offset without using or
+ * changing the file position */
+ssize_t vfs_pread(fd_t* fd, void* buffer, uint64_t length, uint64_t offset);
+ssize_t vfs_write(fd_t* fd, void* buffer, uint64_t length);
+
+/* write at the given offset without using or
+ * changing the file position */
+ssize_t vfs_pwrite(fd_t* fd, void* buffer, uint64_t length, uint64_t offset);
 uint64_t vfs_seek(fd_t* fd, uint64_t offset, int whence);
+
+/* open another fd for the file behind fd, which
+ * has to be closed with vfs_close() as well. */
 fd_t* vfs_dup(fd_t* fd);
 
 /* filesystem manipulation functions */
@@ -19,8 +19,70 @@ void* _kmalloc(size_t size);
 
 void kfree(void* ptr);
 
-size_t alloc_page();
-void* alloc_dma_region();
+/* alloc_page() flags */
+#define PAGE_NOZERO BIT(0)  // caller overwrites the whole page anyway
+
+/* allocate a single page frame. unless PAGE_NOZERO
+ * is specified, the page is cleared to zero. */
+size_t alloc_page(int flags);
 void free_page(size_t page);
 
-int heap_load(proc_t* proc, size_t addr);
+/* allocate/release a naturally aligned block of
+ * 2^order physically contiguous pages. the pages
+ * are not cleared. returns -1 if out of memory or
+ * if called before setup_page_frames(). */
+size_t alloc_pages(unsigned order);
+void free_pages(size_t ppn, unsigned order);
+
+/* get the number of free page frames */
+size_t free_page_count();
+
+/* move a free page to the pool of pre-zeroed pages.
+ * called by the idle task, never blocks. returns
+ * false if there was nothing to do. */
+int page_prezero();
+
+/* add a reference to a page frame that is going to be
+ * shared. free_page() only releases frames which are
+ * not shared (any more). */
+void page_share(size_t ppn);
+int page_shared(size_t ppn);
+
+/* physical memory zones */
+#define ZONE_DMA32    0   // first 4 GiB of physical memory
+#define ZONE_NORMAL   1   // everything else
+#define ZONE_COUNT    2
+
+/* allocate a physically contiguous region of at least
+ * size bytes from the given zone (or a lower one). the
+ * region starts at a multiple of align and does not cross
+ * a multiple of boundary (both powers of two, boundary
+ * may be 0). the memory is not cleared. returns the
+ * physical address, or NULL if out of memory. the pages
+ * of a region may also be released one by one with
+ * free_page(). */
+void* alloc_contig(size_t size, size_t align, size_t boundary, int zone);
+void free_contig(void* phys_addr, size_t size);
+
+/* same as above, but always from the DMA32 zone */
+void* alloc_dma_region(size_t size, size_t align, size_t boundary);
+void free_dma_region(void* phys_addr, size_t size);
+
+/* the number of pages that is mapped around a faulting
+ * address in one go (fault-around). it is set with the
+ * 'faultaround' command line parameter, which is rounded
+ * down to a power of two. 1 disables fault-around. */
+#define FAULT_AROUND_DEFAULT  16
+#define FAULT_AROUND_MAX      32
+extern size_t fault_around_pages;
+void fault_around_init();
+
+/* get the fault-around window for a fault on virt_page
+ * inside the region of pages [first, end). the window is
+ * aligned to its size. returns the number of pages and
+ * stores the first page of the window in start. */
+size_t fault_around(size_t virt_page, size_t first, size_t end, size_t* start);
+
+/* create the heap area of a process, which covers the
+ * range from the minimum heap break to proc->heap_brk. */
+void heap_init(proc_t* proc);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <util/types.h>
+
+/* mmap() and mprotect() protection flags */
+#define PROT_NONE       0
+#define PROT_READ       BIT(0)
+#define PROT_WRITE      BIT(1)
+#define PROT_EXEC       BIT(2)
+
+/* mmap() flags */
+#define MAP_SHARED      BIT(0)
+#define MAP_PRIVATE     BIT(1)
+#define MAP_FIXED       BIT(4)
+#define MAP_ANONYMOUS   BIT(5)
+
+/* mappings without a fixed address are placed in
+ * the first free range between these addresses. */
+#define MMAP_BASE       0x0000200000000000ul
+#define MMAP_END        0x0000600000000000ul
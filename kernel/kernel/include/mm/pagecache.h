@@ -0,0 +1,72 @@
+#pragma once
+
+#include <util/types.h>
+#include <fs/vfs.h>
+
+/* readahead window sizes in pages. both can be
+ * changed with the readahead_min= and readahead=
+ * kernel command line parameters. readahead=0
+ * turns readahead off. */
+#define READAHEAD_MIN_DEFAULT   4
+#define READAHEAD_MAX_DEFAULT   32
+#define READAHEAD_LIMIT         256
+
+/* the cache evicts pages before it grows any further
+ * if there are less free page frames than this. */
+#define PAGECACHE_LOW_WATER     1024
+
+extern size_t readahead_min;
+extern size_t readahead_max;
+
+/* read the readahead tunables from the command line
+ * and start the readahead kernel task. */
+void pagecache_init();
+
+/* forget about previous accesses of an open file */
+void readahead_reset(readahead_t* ra);
+
+/* get the page frame that caches the page with the
+ * given index of the file opened as fd, reading it from
+ * the file system on a miss. every file object (and
+ * thereby every inode) has its own cache, so all processes
+ * share the same frame. the caller receives a reference
+ * to the frame which it drops with free_page(). the
+ * frame contents must not be modified. */
+int pagecache_get(fd_t* fd, size_t index, size_t* ppn);
+
+/* same as above for count consecutive pages, stored in
+ * ppns. missing pages are read with as few requests as
+ * possible. */
+int pagecache_get_range(fd_t* fd, size_t index, size_t count, size_t* ppns);
+
+/* read from a file through the page cache. the file
+ * system is only asked for pages that are not cached.
+ * sequential reads make the cache prefetch the pages
+ * that follow in the background. */
+ssize_t pagecache_read(fd_t* fd, void* buffer, size_t len, uint64_t offset);
+
+/* write to a file through the page cache. only the
+ * cached pages are updated and marked dirty, they are
+ * written back to the file system later on. */
+ssize_t pagecache_write(fd_t* fd, const void* buffer, size_t len, uint64_t offset);
+
+/* write back the dirty pages of all files which have
+ * been dirty for at least min_age ticks. files are
+ * written in inode order, the pages of a file in runs
+ * of consecutive dirty pages. */
+int pagecache_writeback(size_t min_age);
+
+/* write back all dirty pages of a file. also reports
+ * write-back errors since the last call. */
+int pagecache_fsync(file_t* file);
+
+/* number of dirty pages in the cache */
+size_t pagecache_dirty();
+
+/* evict up to count clean pages which are not referenced
+ * outside of the cache, least recently used first.
+ * returns the number of pages released. */
+size_t pagecache_reclaim(size_t count);
+
+/* print usage statistics of the page cache */
+void pagecache_print();
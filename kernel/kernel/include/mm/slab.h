@@ -0,0 +1,74 @@
+#pragma once
+
+#include <util/types.h>
+#include <sched/mutex.h>
+
+/* objects are always aligned to 16 bytes */
+#define SLAB_ALIGN(size)  (((size) + 15) & ~15ul)
+
+/* allocations up to this size are served by one of
+ * the kmalloc() size-class caches. anything larger
+ * goes to the block allocator in heap.c */
+#define SLAB_MAX_SIZE     1024
+
+struct _slab_struct;
+typedef struct _slab_struct slab_t;
+
+typedef struct _kmem_cache_struct
+{
+  const char* name;
+  size_t obj_size;
+  size_t objs_per_slab;
+
+  /* every slab of the cache is on exactly one of
+   * these lists, depending on how many of its
+   * objects are currently in use. */
+  slab_t* full;
+  slab_t* partial;
+  slab_t* empty;
+
+  /* usage statistics */
+  size_t slab_count;
+  size_t objs_inuse;
+  size_t allocs;
+  size_t frees;
+
+  mutex_t lock;
+
+  /* caches register themselves in the global
+   * cache list when they allocate their first slab. */
+  int registered;
+  struct _kmem_cache_struct* next;
+} kmem_cache_t;
+
+#define KMEM_CACHE_INITIALIZER(cache_name, size) {  \
+  .name = cache_name,                               \
+  .obj_size = SLAB_ALIGN(size),                     \
+  .objs_per_slab = 0,                               \
+  .full = NULL,                                     \
+  .partial = NULL,                                  \
+  .empty = NULL,                                    \
+  .slab_count = 0,                                  \
+  .objs_inuse = 0,                                  \
+  .allocs = 0,                                      \
+  .frees = 0,                                       \
+  .lock = MUTEX_INITIALIZER,                        \
+  .registered = false,                              \
+  .next = NULL                                      \
+}
+
+/* allocate an object from the given cache. the
+ * object memory is not cleared. */
+void* kmem_cache_alloc(kmem_cache_t* cache);
+
+/* release an object that was allocated from any
+ * cache. the owning cache is determined from the
+ * slab header. kfree() may be used as well. */
+void kmem_free(void* obj);
+
+/* get the kmalloc() size-class cache for objects
+ * of the given size, or NULL if size is too big. */
+kmem_cache_t* kmem_size_cache(size_t size);
+
+/* print usage statistics of all caches */
+void kmem_cache_print();
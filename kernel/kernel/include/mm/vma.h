@@ -0,0 +1,87 @@
+#pragma once
+
+#include <util/types.h>
+#include <sched/rwlock.h>
+
+struct _proc_struct;
+typedef struct _proc_struct proc_t;
+
+struct _vma_struct;
+typedef struct _vma_struct vma_t;
+
+/* vma_t flags */
+#define VMA_NOFORK    BIT(0)  // not copied to forked children
+#define VMA_NOACCESS  BIT(1)  // any access faults (PROT_NONE)
+
+typedef struct
+{
+  const char* name;
+
+  /* load the page at virt_page, which lies inside the
+   * area and is not mapped yet. returns the number of
+   * pages mapped, or a negative error code. called with
+   * the area tree locked for reading. */
+  int (*fault)(proc_t* proc, vma_t* vma, size_t virt_page);
+
+  /* optional. open is called for copies of an area
+   * (split, fork), which share its data, close when an
+   * area is freed. */
+  void (*open)(vma_t* vma);
+  void (*close)(vma_t* vma);
+} vma_ops_t;
+
+/* a virtual memory area is a range of pages
+ * [start, end) of a process' address space that
+ * is backed by the same kind of memory. */
+struct _vma_struct
+{
+  size_t start;
+  size_t end;
+  int prot;               // PG_WRITE, PG_NOEXEC
+  int flags;
+  const vma_ops_t* ops;
+  void* data;             // private data of the fault handler
+  size_t pgoff;           // first page within the backing object
+
+  /* AVL tree linkage, ordered by start page */
+  vma_t* left;
+  vma_t* right;
+  int height;
+};
+
+vma_t* vma_create(size_t start, size_t end, int prot, int flags,
+                  const vma_ops_t* ops, void* data);
+
+/* free an area which is not part of a tree */
+void vma_free(vma_t* vma);
+
+/* insert an area into or remove it from the tree of
+ * the process. the tree has to be locked for writing.
+ * returns -EEXIST if the area overlaps another one. */
+int vma_insert(proc_t* proc, vma_t* vma);
+void vma_remove(proc_t* proc, vma_t* vma);
+
+/* split an area at page, which has to lie inside of it.
+ * the upper part is inserted as a new area and returned.
+ * the tree has to be locked for writing. */
+vma_t* vma_split(proc_t* proc, vma_t* vma, size_t page);
+
+/* find the area containing virt_page, or the lowest
+ * area overlapping the range [start, end). the tree has
+ * to be locked. return NULL if there is none. */
+vma_t* vma_find(proc_t* proc, size_t virt_page);
+vma_t* vma_overlap(proc_t* proc, size_t start, size_t end);
+
+/* copy all areas except VMA_NOFORK ones to a forked child */
+void vma_clone(proc_t* parent, proc_t* child);
+
+/* free all areas of a process which is being deleted */
+void vma_destroy_all(proc_t* proc);
+
+/* resolve a fault on a page that is not mapped by
+ * calling the handler of the area containing it, or a
+ * write fault on a present copy-on-write page. returns
+ * the number of pages mapped, -ENOENT if there is no area
+ * or -EFAULT if the access is not permitted. */
+int vma_fault(proc_t* proc, size_t virt_page,
+              int present, int write, int exec);
@@ -8,6 +8,11 @@
 #define PG_WRITE    BIT(1)
 #define PG_NOEXEC   BIT(2)
 
+/* huge pages map 2 MiB at once */
+#define HUGE_PAGE_ORDER   9
+#define HUGE_PAGE_PAGES   (1ul << HUGE_PAGE_ORDER)
+#define HUGE_PAGE_SIZE    (HUGE_PAGE_PAGES * PAGE_SIZE)
+
 typedef struct _vspace_struct vspace_t;
 
 extern vspace_t _vspace_kernel;
@@ -21,6 +26,9 @@ void* phys_to_virt(void* phys_addr);
  * corresponding page frame number. */
 void* ppn_to_virt(size_t ppn);
 
+/* fill the page at the specified address with zeroes */
+void clear_page(void* page);
+
 /* resolve a virtual address to a physical one */
 size_t virt_to_ppn(vspace_t *vspace, void* virt_addr);
 
@@ -33,16 +41,59 @@ vspace_t* vspace_create();
 
 void vspace_delete(vspace_t* vspace);
 
-/* switch to the specified virtual address space. */
+/* switch to the specified virtual address space. does
+ * nothing if it is the active address space already. */
 void vspace_apply(vspace_t* vspace);
 
 /* map a single page into the specified virtual
  * address space. additional flags can be specified
  * to control read/write, user/supervisor and exec/noexec
- * permissions. */
-void vspace_map(vspace_t* vspace, size_t virt, size_t phys, int flags);
+ * permissions. returns -EEXIST if the page is already
+ * mapped, the caller still owns the frame in that case. */
+int vspace_map(vspace_t* vspace, size_t virt, size_t phys, int flags);
 
 /* unmap the specified page from the referenced virtual
  * address space. */
 int vspace_unmap(vspace_t* vspace, size_t virt);
 
+/* map count pages starting at virt, each backed by a newly
+ * allocated page frame which is cleared to zero. pages that
+ * are already mapped are left untouched. returns the number
+ * of pages that were newly mapped. */
+size_t vspace_map_range(vspace_t* vspace, size_t virt, size_t count, int flags);
+
+/* unmap count pages starting at virt and release their page
+ * frames. the page tables are walked only once and the TLB
+ * is flushed in a single batch. returns the number of pages
+ * that were actually mapped. */
+size_t vspace_unmap_range(vspace_t* vspace, size_t virt, size_t count);
+
+/* change the permissions (PG_USER, PG_WRITE, PG_NOEXEC)
+ * of all pages mapped in the range of count pages at virt.
+ * pages without PG_USER are kept, but can't be accessed
+ * from user mode. */
+void vspace_protect(vspace_t* vspace, size_t virt, size_t count, int flags);
+
+/* map a huge page of HUGE_PAGE_PAGES frames starting
+ * at phys. both virt and phys must be aligned to the
+ * huge page size. returns -EEXIST if any part of the
+ * range is already mapped. */
+int vspace_map_huge(vspace_t* vspace, size_t virt, size_t phys, int flags);
+
+
+/* create a copy of the user part of the address space.
+ * page frames are shared, and all pages become
+ * copy-on-write pages in both address spaces. */
+vspace_t* vspace_clone(vspace_t* vspace);
+
+/* resolve a write fault on a copy-on-write page by
+ * giving the address space its own copy of the frame.
+ * returns -EFAULT if virt is not a copy-on-write page. */
+int vspace_cow(vspace_t* vspace, size_t virt);
+
+/* check whether a page is mapped at virt */
+int vspace_mapped(vspace_t* vspace, size_t virt);
+
+/* check whether virt is mapped by a huge page */
+int vspace_is_huge(vspace_t* vspace, size_t virt);
+
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <util/types.h>
+#include <fs/vfs.h>
+#include <time.h>
+
+/* background write-back starts once there are more
+ * dirty pages than this, writers are throttled (they
+ * write back their own file) above the limit. */
+#define DIRTY_BACKGROUND_PAGES  256
+#define DIRTY_LIMIT_PAGES       1024
+
+/* same for the buffer cache */
+#define DIRTY_BACKGROUND_BUFFERS  512
+
+/* dirty data older than this is written back
+ * by the periodic flush, which runs every
+ * WRITEBACK_INTERVAL ticks. */
+#define DIRTY_EXPIRE        (5 * TIMER_HZ)
+#define WRITEBACK_INTERVAL  TIMER_HZ
+
+/* start the flusher kernel task */
+void writeback_init();
+
+/* ask the flusher to write back everything
+ * as soon as possible */
+void writeback_wakeup();
+
+/* write back all dirty data and wait for it. returns
+ * -EIO if anything could not be written, now or in the
+ * background since the last sync. */
+int writeback_sync();
+
+/* write back the dirty pages of a single file
+ * and all dirty buffers, and wait for it. earlier
+ * write-back errors are reported as well. */
+int writeback_file(file_t* file);
@@ -27,4 +27,12 @@ typedef struct
 
 loader_t* loader_create(fd_t* file);
 void loader_release(loader_t* ldr);
-int loader_load(loader_t* ldr, size_t virt_page, vspace_t* vspace);
+
+/* add a reference to the loader, e.g. for a forked process */
+loader_t* loader_dup(loader_t* ldr);
+struct _proc_struct;
+
+/* create a memory area for every loadable segment of the
+ * binary. their pages are loaded on demand by the fault
+ * handler, together with their neighbours (fault-around). */
+int loader_add_vmas(loader_t* ldr, struct _proc_struct* proc);
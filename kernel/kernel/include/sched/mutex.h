@@ -43,6 +43,7 @@ typedef struct _mutex_struct
 void mutex_init(mutex_t *mtx);
 int mutex_held(mutex_t* mtx);
 void mutex_lock(mutex_t* mtx);
+int mutex_trylock(mutex_t* mtx);
 void mutex_unlock(mutex_t* mtx);
 void mutex_destroy(mutex_t* mtx);
 
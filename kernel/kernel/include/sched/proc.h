@@ -4,6 +4,7 @@
 #include <sched/mutex.h>
 #include <util/list.h>
 #include <mm/vspace.h>
+#include <mm/vma.h>
 #include <fs/vfs.h>
 #include <sched/loader.h>
 
@@ -45,13 +46,24 @@ typedef struct _proc_struct
   /* the process' virtual address space */
   vspace_t* vspace;
 
+  /* the tree of virtual memory areas. the fault
+   * handlers run with vma_lock held for reading. */
+  vma_t* vmas;
+  rwlock_t vma_lock;
+
   /* heap data */
   size_t heap_brk;
   mutex_t heap_lock;
+  vma_t* heap_vma;
 
   dir_t* working_dir;
 
   loader_t* loader;
+
+  /* page fault statistics: the number of faults
+   * taken and the number of pages they mapped. */
+  size_t faults;
+  size_t fault_pages;
 } proc_t;
 
 /* start a new process by loading the ELF binary
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <util/types.h>
+#include <sched/mutex.h>
+
+/* a readers-writer lock. any number of readers may hold
+ * the lock at the same time, while a writer has exclusive
+ * access. waiting writers keep new readers from entering. */
+typedef struct _rwlock_struct
+{
+  /* held by writers for the whole critical section
+   * and by readers only while entering. */
+  mutex_t writer;
+  size_t readers;
+} rwlock_t;
+
+#define RWLOCK_INITIALIZER {        \
+  .writer = MUTEX_INITIALIZER,      \
+  .readers = 0                      \
+}
+
+void rwlock_init(rwlock_t* rw);
+void rwlock_destroy(rwlock_t* rw);
+void rwlock_read_lock(rwlock_t* rw);
+void rwlock_read_unlock(rwlock_t* rw);
+void rwlock_write_lock(rwlock_t* rw);
+void rwlock_write_unlock(rwlock_t* rw);
+int rwlock_write_held(rwlock_t* rw);
+
+/* true if the lock is held for reading by anyone
+ * or for writing by the current task */
+int rwlock_held(rwlock_t* rw);
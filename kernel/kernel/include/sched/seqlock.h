@@ -0,0 +1,34 @@
+#pragma once
+
+#include <util/types.h>
+
+/* compiler barrier. x86 neither reorders stores with
+ * other stores nor loads with other loads, so this is
+ * all the ordering that lock-free readers need. */
+#define barrier() __asm__ volatile ("" ::: "memory")
+
+/* a sequence count lets readers access data without
+ * locking, as long as they retry whenever a writer has
+ * been active meanwhile. writers have to be serialized
+ * by some other lock. */
+typedef struct _seqcount_struct
+{
+  size_t sequence;
+} seqcount_t;
+
+#define SEQCOUNT_INITIALIZER {  \
+  .sequence = 0                 \
+}
+
+void seqcount_init(seqcount_t* seq);
+
+/* start a read section. returns the sequence
+ * number to pass to read_seqretry(). */
+size_t read_seqbegin(seqcount_t* seq);
+
+/* true if a writer has been active since the
+ * read section began, so it has to be retried. */
+int read_seqretry(seqcount_t* seq, size_t start);
+
+void write_seqbegin(seqcount_t* seq);
+void write_seqend(seqcount_t* seq);
@@ -37,6 +37,10 @@ extern task_t* current_task;
 task_t* create_kernel_task(void (*func)(void));
 task_t* create_user_task(vspace_t* vspace, void* entry, userstack_t* stack);
 
+/* create a copy of a user task that is currently in a
+ * system call. the copy returns 0 from that system call. */
+task_t* create_forked_task(vspace_t* vspace, task_t* parent);
+
 /* kill the current_task */
 void task_kill();
 
@@ -25,10 +25,17 @@ typedef struct
    * or can be used by a new thread. */
   int allocated;
   size_t pages_mapped;
+
+  /* the memory area covering the stack, as
+   * long as it is allocated. */
+  vma_t* vma;
 } userstack_t;
 
 userstack_t* create_stack(proc_t *process);
 
-int stack_load(proc_t* proc, size_t virt_page);
-
 void delete_stack(proc_t* process, size_t tid);
+
+/* copy the stack list of a process to its forked child.
+ * only the stack with the given index remains allocated,
+ * the pages of all others are removed from the child. */
+void fork_stacks(proc_t* parent, proc_t* child, size_t index);
@@ -15,12 +15,18 @@ size_t    sys_getpid();
 
 /* memory management and allocation */
 void*     sys_sbrk(ssize_t increment);
+void*     sys_mmap(void* addr, size_t length, int prot, int flags,
+                   int fd, size_t offset);
+int       sys_munmap(void* addr, size_t length);
+int       sys_mprotect(void* addr, size_t length, int prot);
 
 /* filesystem access */
 ssize_t   sys_read(int fd, char* buffer, size_t len);
 ssize_t   sys_write(int fd, char* buffer, size_t len);
 int       sys_open(char* path, int flags, int mode);
 int       sys_close(int fd);
+int       sys_fsync(int fd);
+int       sys_sync();
 
 /* interprocess communication */
 int       sys_pipe(int* read_end, int* write_end);
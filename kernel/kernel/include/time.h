@@ -2,4 +2,14 @@
 
 #include <util/types.h>
 
+/* the timer interrupt fires at the default
+ * rate of the PIT, which is about 18.2 Hz. */
+#define TIMER_HZ  18
+
 uint64_t time();
+
+/* number of timer interrupts since boot */
+size_t ticks();
+
+/* called by the timer interrupt handler */
+void timer_tick();
@@ -9,6 +9,9 @@
 #include <fs/vfs.h>
 #include <fs/ramdisk.h>
 #include <fs/blockdev.h>
+#include <mm/memory.h>
+#include <mm/pagecache.h>
+#include <mm/writeback.h>
 #include <bus/pci.h>
 #include <util/string.h>
 
@@ -41,6 +44,11 @@ static void init_task_func()
   /* initialize the block device manager */
   blockdev_init();
 
+  /* start the page cache's readahead task and
+   * the flusher, which writes back dirty data. */
+  pagecache_init();
+  writeback_init();
+
   /* initialize device drivers */
   init_drivers();
 
@@ -77,6 +85,7 @@ void kmain(const char *cmdline, void *initrd, size_t initrd_size)
 
   debug(INIT, "reached kmain()\n");
   cmdline_parse(cmdline);
+  fault_around_init();
   s_initrd = initrd;
   s_initrd_size = initrd_size;
 
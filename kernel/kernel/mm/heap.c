@@ -2,8 +2,10 @@
 #include <sched/mutex.h>
 #include <mm/memory.h>
 #include <mm/vspace.h>
+#include <mm/slab.h>
 #include <arch/common.h>
 #include <debug.h>
+#include <errno.h>
 
 typedef struct _hblock
 {
@@ -11,6 +13,8 @@ typedef struct _hblock
   unsigned magic;
   struct _hblock *prev;
   struct _hblock *next;
+  struct _hblock *free_prev;
+  struct _hblock *free_next;
 #ifdef DEBUG
   const char* function;
   unsigned int line;
@@ -21,19 +25,119 @@ typedef struct _hblock
 #define HEAP_MAGIC  (0xabcdefabu)
 #define HEADER_SIZE (sizeof(hblock_t))
 
+/*
+ * free blocks are indexed by a two-level segregated
+ * fit (TLSF) scheme: the first level splits block sizes
+ * into powers of two, the second level splits each of
+ * those ranges into SL_COUNT linear subranges. a bitmap
+ * per level tells which free lists are non-empty, so a
+ * fitting block can be found with two bit scans instead
+ * of walking the heap.
+ */
+#define SL_LOG2     4
+#define SL_COUNT    (1 << SL_LOG2)
+#define FL_COUNT    64
+
+static uint64_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_COUNT];
+static hblock_t* free_lists[FL_COUNT][SL_COUNT];
+
 void* kheap_start_ = (void*)KHEAP_START;
 void* kheap_break_ = (void*)KHEAP_START;
 
+/* end of the mapped part of the heap. as the heap is
+ * mapped in huge pages, this is usually beyond the break. */
+static size_t kheap_mapped_ = KHEAP_START;
+
 static hblock_t *heap_start = NULL;
 static hblock_t *heap_last = NULL;
 static mutex_t  kheap_mutex = MUTEX_INITIALIZER;
 
+static unsigned fls(size_t value)
+{
+  return 63 - __builtin_clzl(value);
+}
+
+static void mapping(size_t size, unsigned* fl, unsigned* sl)
+{
+  /* blocks are always bigger than the header,
+   * so the first level is always >= SL_LOG2. */
+  *fl = fls(size);
+  *sl = (size >> (*fl - SL_LOG2)) & (SL_COUNT - 1);
+}
+
+static void free_insert(hblock_t* block)
+{
+  unsigned fl, sl;
+  mapping(block->size, &fl, &sl);
+
+  block->free_prev = NULL;
+  block->free_next = free_lists[fl][sl];
+  if (block->free_next)
+    block->free_next->free_prev = block;
+  free_lists[fl][sl] = block;
+
+  fl_bitmap |= BIT(fl);
+  sl_bitmap[fl] |= BIT(sl);
+}
+
+static void free_remove(hblock_t* block)
+{
+  unsigned fl, sl;
+  mapping(block->size, &fl, &sl);
+
+  if (block->free_prev)
+    block->free_prev->free_next = block->free_next;
+  else
+    free_lists[fl][sl] = block->free_next;
+  if (block->free_next)
+    block->free_next->free_prev = block->free_prev;
+
+  if (free_lists[fl][sl] == NULL)
+  {
+    sl_bitmap[fl] &= ~BIT(sl);
+    if (sl_bitmap[fl] == 0)
+      fl_bitmap &= ~BIT(fl);
+  }
+}
+
+static hblock_t* free_search(size_t size)
+{
+  /* round the requested size up to the next
+   * subrange, so any block of the list that is
+   * found is guaranteed to be big enough. */
+  size += (1ul << (fls(size) - SL_LOG2)) - 1;
+
+  unsigned fl, sl;
+  mapping(size, &fl, &sl);
+  if (fl >= FL_COUNT)
+    return NULL;
+
+  uint32_t sl_map = sl_bitmap[fl] & (~0u << sl);
+  if (sl_map == 0)
+  {
+    /* no block in this first level range, take
+     * the smallest block of the next bigger one. */
+    const uint64_t fl_map = (fl + 1 < FL_COUNT) ?
+          fl_bitmap & (~0ul << (fl + 1)) : 0;
+    if (fl_map == 0)
+      return NULL;
+
+    fl = __builtin_ctzl(fl_map);
+    sl_map = sl_bitmap[fl];
+  }
+
+  sl = __builtin_ctz(sl_map);
+  return free_lists[fl][sl];
+}
+
 void kheap_print()
 {
   mutex_lock(&kheap_mutex);
   const unsigned loglevel = KHEAP|OUTPUT_ENABLED;
 
   debug(loglevel, "-- heap dump:\n");
+  size_t free_bytes = 0, free_blocks = 0, largest_free = 0;
   hblock_t *entry;
   for (entry = heap_start; entry != NULL; entry = entry->next)
   {
@@ -43,7 +147,10 @@ void kheap_print()
 
     if (entry->available)
     {
-      debug(loglevel, "  @ %p: %zu bytes (free)\n");
+      debug(loglevel, "  @ %p: %zu bytes (free)\n", entry + 1, entry->size);
+      free_bytes += entry->size;
+      free_blocks++;
+      largest_free = max(largest_free, entry->size);
     }
     else
     {
@@ -56,12 +163,18 @@ void kheap_print()
     }
   }
 
+  debug(loglevel, "-- %zu bytes in %zu free blocks (largest %zu), "
+        "heap size %zu bytes\n", free_bytes, free_blocks, largest_free,
+        (size_t)(kheap_break_ - kheap_start_));
+
   mutex_unlock(&kheap_mutex);
+
+  kmem_cache_print();
 }
 
 void _kheap_check_corrupt(const char* func, unsigned line)
 {
-  for (hblock_t* entry = kheap_start_;
+  for (hblock_t* entry = heap_start;
        entry != NULL;
        entry = entry->next)
   {
@@ -73,34 +186,69 @@ void _kheap_check_corrupt(const char* func, unsigned line)
   }
 }
 
-static void* kbrk(ssize_t increment)
+static void kheap_map(size_t end)
 {
-  void *orig_brk = kheap_break_;
-  kheap_break_ += increment;
-
-
-  if (orig_brk > kheap_break_)
+  while (kheap_mapped_ < end)
   {
-    size_t first_unmap = (size_t)kheap_break_ / PAGE_SIZE;
-    if ((size_t)kheap_break_ % PAGE_SIZE != 0)
-      first_unmap += 1;
-    size_t last_unmap = (size_t)orig_brk / PAGE_SIZE;
+    /* map the heap in huge pages if possible, which
+     * saves page tables and TLB entries. fall back to
+     * single pages if there is no 2 MiB block left. */
+    const size_t page = kheap_mapped_ >> PAGE_SHIFT;
+    if (page % HUGE_PAGE_PAGES == 0)
+    {
+      const size_t ppn = alloc_pages(HUGE_PAGE_ORDER);
+      if (ppn != (size_t)-1)
+      {
+        for (size_t i = 0; i < HUGE_PAGE_PAGES; i++)
+          clear_page(ppn_to_virt(ppn + i));
+
+        if (vspace_map_huge(VSPACE_KERNEL, page, ppn,
+                            PG_NOEXEC|PG_WRITE) == SUCCESS)
+        {
+          kheap_mapped_ += HUGE_PAGE_SIZE;
+          continue;
+        }
+        free_pages(ppn, HUGE_PAGE_ORDER);
+      }
+    }
 
-    for (size_t page = first_unmap; page <= last_unmap; page++)
-      vspace_unmap(VSPACE_KERNEL, page);
+    /* map single pages up to the end or
+     * the next huge page boundary. */
+    size_t next = (kheap_mapped_ | (HUGE_PAGE_SIZE - 1)) + 1;
+    next = min(next, (end + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1));
+    vspace_map_range(VSPACE_KERNEL, page,
+        (next - kheap_mapped_) >> PAGE_SHIFT, PG_NOEXEC|PG_WRITE);
+    kheap_mapped_ = next;
   }
-  else
-  {
-    size_t first_map = (size_t)orig_brk / PAGE_SIZE;
-    if ((size_t)orig_brk % PAGE_SIZE != 0)
-      first_map += 1;
-    size_t last_map = (size_t)kheap_break_ / PAGE_SIZE;
+}
 
-    for (size_t page = first_map; page <= last_map; page++)
-    {
-      vspace_map(VSPACE_KERNEL, page, alloc_page(), PG_NOEXEC|PG_WRITE);
-    }
+static void kheap_unmap(size_t end)
+{
+  end = (end + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1);
+  while (kheap_mapped_ > end)
+  {
+    /* huge pages are only released once they
+     * are not used by the heap at all anymore. */
+    const size_t chunk = (kheap_mapped_ - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (chunk < end && vspace_is_huge(VSPACE_KERNEL, chunk >> PAGE_SHIFT))
+      break;
+
+    const size_t first = max(chunk, end);
+    vspace_unmap_range(VSPACE_KERNEL, first >> PAGE_SHIFT,
+                       (kheap_mapped_ - first) >> PAGE_SHIFT);
+    kheap_mapped_ = first;
   }
+}
+
+static void* kbrk(ssize_t increment)
+{
+  void *orig_brk = kheap_break_;
+  kheap_break_ += increment;
+
+  if (increment > 0)
+    kheap_map((size_t)kheap_break_);
+  else
+    kheap_unmap((size_t)kheap_break_);
 
   return orig_brk;
 }
@@ -132,6 +280,8 @@ static void crop(hblock_t *block, size_t new_size)
     // update heap info
     heap_last = block->next;
   }
+
+  free_insert(block->next);
 }
 
 #ifdef DEBUG
@@ -144,55 +294,66 @@ void *_kmalloc(size_t size)
   debug(KHEAP, "kmalloc(): size %zd from %s():%u\n", size, function, line);
 #endif
 
+  /* small allocations are served by the slab
+   * allocator's size-class caches. */
+  kmem_cache_t* cache = kmem_size_cache(size);
+  if (cache)
+    return kmem_cache_alloc(cache);
+
   mutex_lock(&kheap_mutex);
 
-  hblock_t *entry;
-  for (entry = heap_start; entry != NULL; entry = entry->next)
+  const size_t required_size = HEADER_SIZE + size;
+  hblock_t *blk = free_search(required_size);
+  if (blk != NULL)
   {
-    if (entry->magic != HEAP_MAGIC) {
+    if (blk->magic != HEAP_MAGIC || !blk->available) {
       kpanic(false, "kheap: heap corruption detected");
     }
 
-    size_t required_size = HEADER_SIZE + size;
-    if (entry->available && entry->size >= required_size)
-    {
-      entry->available = 0;
-
-#ifdef DEBUG
-      entry->function = function;
-      entry->line = line;
-#endif
-
-      crop(entry, required_size);
+    free_remove(blk);
+    crop(blk, required_size);
+  }
+  else if (heap_last != NULL && heap_last->available)
+  {
+    /* the last block is free but too small. instead
+     * of appending a new block, grow the last one. */
+    blk = heap_last;
+    free_remove(blk);
+    if (kbrk(required_size - blk->size) == (void*)-1) {
+      free_insert(blk);
       mutex_unlock(&kheap_mutex);
-      return entry + 1;
+      return NULL;
     }
+    blk->size = required_size;
   }
+  else
+  {
+    blk = kbrk(required_size);
+    if (blk == (void*)-1) {
+      mutex_unlock(&kheap_mutex);
+      return NULL;
+    }
 
-  hblock_t *blk = kbrk(size + HEADER_SIZE);
-  if (blk == (void*)-1) {
-    mutex_unlock(&kheap_mutex);
-    return NULL;
+    blk->magic = HEAP_MAGIC;
+    blk->next = NULL;
+    blk->prev = heap_last;
+    blk->size = required_size;
+
+    if (heap_last != NULL)
+      heap_last->next = blk;
+    heap_last = blk;
+
+    if (heap_start == NULL)
+      heap_start = blk;
   }
 
   blk->available = 0;
-  blk->magic = HEAP_MAGIC;
-  blk->next = NULL;
-  blk->prev = heap_last;
-  blk->size = HEADER_SIZE + size;
 
 #ifdef DEBUG
   blk->function = function;
   blk->line = line;
 #endif
 
-  if (heap_last != NULL)
-    heap_last->next = blk;
-  heap_last = blk;
-
-  if (heap_start == NULL)
-    heap_start = blk;
-
   mutex_unlock(&kheap_mutex);
 
   return blk + 1;
@@ -222,6 +383,13 @@ void kfree(void *ptr)
     return;
   }
 
+  /* anything outside of the heap region was
+   * allocated from a slab cache. */
+  if (ptr < kheap_start_ || ptr >= kheap_break_) {
+    kmem_free(ptr);
+    return;
+  }
+
   if (heap_last == NULL || heap_start == NULL ||
         ptr < (void*)(heap_start) || ptr > (void*)(heap_last + 1)) {
     kpanic(false, "kheap: heap corruption detected");
@@ -237,29 +405,36 @@ void kfree(void *ptr)
   tofree->available = 1;
 
   // merge free blocks
-  if (tofree->next != NULL && tofree->next->available)
+  if (tofree->next != NULL && tofree->next->available) {
+    free_remove(tofree->next);
+    merge_blocks(tofree, tofree->next);
+  }
+  if (tofree->prev != NULL && tofree->prev->available) {
+    tofree = tofree->prev;
+    free_remove(tofree);
     merge_blocks(tofree, tofree->next);
-  if (tofree->prev != NULL && tofree->prev->available)
-    merge_blocks(tofree->prev, tofree);
+  }
 
-  // decrease heap size when possible
-  while (heap_last != NULL && heap_last->available)
+  if (tofree != heap_last)
   {
-    // invalidate
-    heap_last->magic = 0;
-
-    size_t decrement = heap_last->size;
-    if (heap_last->prev != NULL) {
-      heap_last->prev->next = NULL;
-      heap_last = heap_last->prev;
-    } else {
-      heap_start = NULL;
-      heap_last = NULL;
-    }
+    free_insert(tofree);
+    mutex_unlock(&kheap_mutex);
+    return;
+  }
 
-    // decrease heap break
-    kbrk(-decrement);
+  // decrease heap size, the last block is free
+  tofree->magic = 0;
+  size_t decrement = tofree->size;
+  if (tofree->prev != NULL) {
+    tofree->prev->next = NULL;
+    heap_last = tofree->prev;
+  } else {
+    heap_start = NULL;
+    heap_last = NULL;
   }
 
+  // decrease heap break
+  kbrk(-decrement);
+
   mutex_unlock(&kheap_mutex);
 }
@@ -0,0 +1,287 @@
+/*
+ * UlmerOS memory mappings
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * mmap() creates a memory area which is either backed by
+ * anonymous, zero-filled memory or by a file. file pages
+ * are mapped straight from the page cache, so there is no
+ * copy involved. file mappings are read-only, as there is
+ * no way to write pages back yet. every file mapping has
+ * its own fd, so the file can be closed while mapped.
+ */
+
+#include <syscalls.h>
+#include <sched/task.h>
+#include <sched/proc.h>
+#include <arch/definitions.h>
+#include <mm/mman.h>
+#include <mm/vma.h>
+#include <mm/vspace.h>
+#include <mm/memory.h>
+#include <mm/pagecache.h>
+#include <debug.h>
+#include <errno.h>
+
+static int anon_fault(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  size_t start;
+  const size_t count = fault_around(virt_page, vma->start, vma->end, &start);
+  return vspace_map_range(proc->vspace, start, count, PG_USER | vma->prot);
+}
+
+static int file_fault(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  fd_t* fd = vma->data;
+  size_t start;
+  const size_t count = fault_around(virt_page, vma->start, vma->end, &start);
+  const size_t end = start + count;
+
+  /* every run of missing pages is taken from
+   * the page cache at once. */
+  int mapped = 0;
+  size_t page = start;
+  while (page < end)
+  {
+    size_t run = 0;
+    while (page + run < end && !vspace_mapped(proc->vspace, page + run))
+      run++;
+
+    if (run > 0)
+    {
+      size_t ppns[FAULT_AROUND_MAX];
+      const size_t index = vma->pgoff + (page - vma->start);
+      int error = pagecache_get_range(fd, index, run, ppns);
+      if (error < 0)
+        return error;
+
+      for (size_t i = 0; i < run; i++)
+      {
+        if (vspace_map(proc->vspace, page + i, ppns[i], PG_USER | vma->prot) < 0)
+          free_page(ppns[i]);
+        else
+          mapped++;
+      }
+    }
+    page += run + 1;
+  }
+
+  return mapped;
+}
+
+static void file_open(vma_t* vma)
+{
+  vma->data = vfs_dup(vma->data);
+}
+
+static void file_close(vma_t* vma)
+{
+  vfs_close(vma->data);
+}
+
+static const vma_ops_t anon_vma_ops = {
+  .name = "anonymous mapping",
+  .fault = anon_fault
+};
+
+static const vma_ops_t file_vma_ops = {
+  .name = "file mapping",
+  .fault = file_fault,
+  .open = file_open,
+  .close = file_close
+};
+
+static int is_mapping(vma_t* vma)
+{
+  return vma->ops == &anon_vma_ops || vma->ops == &file_vma_ops;
+}
+
+static int prot_flags(int prot)
+{
+  int flags = 0;
+  if (prot & PROT_WRITE)
+    flags |= PG_WRITE;
+  if (!(prot & PROT_EXEC))
+    flags |= PG_NOEXEC;
+  return flags;
+}
+
+static size_t mmap_find_free(proc_t* proc, size_t hint, size_t count)
+{
+  assert(rwlock_held(&proc->vma_lock), "VMA tree not locked");
+
+  /* use the hint if the range is free. otherwise, skip
+   * over the areas in the way until there is a gap. */
+  if (hint > 0 && hint + count <= (USER_BREAK >> PAGE_SHIFT) &&
+      !vma_overlap(proc, hint, hint + count))
+    return hint;
+
+  size_t start = MMAP_BASE >> PAGE_SHIFT;
+  while (start + count <= (MMAP_END >> PAGE_SHIFT))
+  {
+    vma_t* vma = vma_overlap(proc, start, start + count);
+    if (vma == NULL)
+      return start;
+    start = vma->end;
+  }
+  return 0;
+}
+
+static int mmap_unmap(proc_t* proc, size_t start, size_t end)
+{
+  assert(rwlock_write_held(&proc->vma_lock), "VMA tree not locked");
+
+  /* only mappings can be removed, other areas (like
+   * stacks or the heap) must not be touched. */
+  vma_t* vma;
+  for (size_t page = start; (vma = vma_overlap(proc, page, end)); page = vma->end)
+  {
+    if (!is_mapping(vma))
+      return -EINVAL;
+  }
+
+  /* areas which are only partly covered are split */
+  while ((vma = vma_overlap(proc, start, end)))
+  {
+    if (vma->start < start)
+      vma = vma_split(proc, vma, start);
+    if (vma->end > end)
+      vma_split(proc, vma, end);
+
+    vma_remove(proc, vma);
+    vma_free(vma);
+  }
+
+  vspace_unmap_range(proc->vspace, start, end - start);
+  return SUCCESS;
+}
+
+void* sys_mmap(void* addr, size_t length, int prot, int flags,
+               int fd, size_t offset)
+{
+  proc_t* process = current_task->process;
+  const size_t count = (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  if (count == 0 || offset % PAGE_SIZE != 0 ||
+      !(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    return (void*)-EINVAL;
+
+  /* anonymous memory is always private to the process,
+   * files can only be mapped for reading. */
+  fd_t* file = NULL;
+  if (flags & MAP_ANONYMOUS)
+  {
+    if (flags & MAP_SHARED)
+      return (void*)-ENOTSUP;
+  }
+  else
+  {
+    if ((file = proc_get_fd(process, fd)) == NULL)
+      return (void*)-EBADF;
+    if (file->f_ops.read == NULL)
+      return (void*)-ENODEV;
+    if (prot & PROT_WRITE)
+      return (void*)-EACCES;
+  }
+
+  rwlock_write_lock(&process->vma_lock);
+
+  /* fixed mappings replace whatever is mapped there */
+  size_t start = (size_t)addr >> PAGE_SHIFT;
+  int error = SUCCESS;
+  if (flags & MAP_FIXED)
+  {
+    if ((size_t)addr % PAGE_SIZE != 0 || start == 0 ||
+        start + count > (USER_BREAK >> PAGE_SHIFT))
+      error = -EINVAL;
+    else
+      error = mmap_unmap(process, start, start + count);
+  }
+  else if ((start = mmap_find_free(process, start, count)) == 0)
+  {
+    error = -ENOMEM;
+  }
+
+  if (error == SUCCESS)
+  {
+    vma_t* vma = vma_create(start, start + count, prot_flags(prot),
+        prot == PROT_NONE ? VMA_NOACCESS : 0,
+        file ? &file_vma_ops : &anon_vma_ops, file ? vfs_dup(file) : NULL);
+    vma->pgoff = offset >> PAGE_SHIFT;
+    error = vma_insert(process, vma);
+    assert(error == SUCCESS, "mmap(): range not free");
+  }
+
+  rwlock_write_unlock(&process->vma_lock);
+  if (error < 0)
+    return (void*)(ssize_t)error;
+
+  debug(SYSCALL, "PID %zu: mmap(): %zu pages @ %p\n",
+        process->pid, count, start << PAGE_SHIFT);
+  return (void*)(start << PAGE_SHIFT);
+}
+
+int sys_munmap(void* addr, size_t length)
+{
+  proc_t* process = current_task->process;
+  const size_t start = (size_t)addr >> PAGE_SHIFT;
+  const size_t count = (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  if ((size_t)addr % PAGE_SIZE != 0 || count == 0 ||
+      start + count > (USER_BREAK >> PAGE_SHIFT))
+    return -EINVAL;
+
+  rwlock_write_lock(&process->vma_lock);
+  int error = mmap_unmap(process, start, start + count);
+  rwlock_write_unlock(&process->vma_lock);
+  return error;
+}
+
+int sys_mprotect(void* addr, size_t length, int prot)
+{
+  proc_t* process = current_task->process;
+  const size_t start = (size_t)addr >> PAGE_SHIFT;
+  const size_t count = (length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  const size_t end = start + count;
+  if ((size_t)addr % PAGE_SIZE != 0 || end > (USER_BREAK >> PAGE_SHIFT))
+    return -EINVAL;
+
+  rwlock_write_lock(&process->vma_lock);
+
+  /* the whole range has to be covered by mappings. */
+  int error = SUCCESS;
+  for (size_t page = start; page < end && error == SUCCESS; )
+  {
+    vma_t* vma = vma_find(process, page);
+    if (vma == NULL || !is_mapping(vma))
+      error = -ENOMEM;
+    else if (vma->ops == &file_vma_ops && (prot & PROT_WRITE))
+      error = -EACCES;
+    else
+      page = vma->end;
+  }
+
+  if (error == SUCCESS)
+  {
+    for (size_t page = start; page < end; )
+    {
+      vma_t* vma = vma_find(process, page);
+      if (vma->start < page)
+        vma = vma_split(process, vma, page);
+      if (vma->end > end)
+        vma_split(process, vma, end);
+
+      vma->prot = prot_flags(prot);
+      if (prot == PROT_NONE)
+        vma->flags |= VMA_NOACCESS;
+      else
+        vma->flags &= ~VMA_NOACCESS;
+      page = vma->end;
+    }
+
+    /* inaccessible pages keep their frames, they are
+     * only taken away from user mode. */
+    vspace_protect(process->vspace, start, count,
+                   prot_flags(prot) | (prot == PROT_NONE ? 0 : PG_USER));
+  }
+
+  rwlock_write_unlock(&process->vma_lock);
+  return error;
+}
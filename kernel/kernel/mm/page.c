@@ -1,63 +1,505 @@
+/*
+ * UlmerOS physical page frame allocator
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * physical memory is managed by a binary buddy allocator.
+ * free memory is kept in blocks of 2^order pages, which
+ * are naturally aligned to their size. each order has its
+ * own free list, so allocating and releasing a block takes
+ * O(MAX_ORDER) steps. on release, a block is merged with
+ * its buddy whenever that one is free as well.
+ *
+ * memory is split into zones, each with its own set of
+ * free lists. the DMA32 zone covers the first 4 GiB, which
+ * is what devices with 32 bit addressing can reach. since
+ * the zone boundary is aligned far beyond the biggest block
+ * size, blocks never span multiple zones. regular page
+ * allocations prefer the normal zone to keep DMA32 memory
+ * available for drivers.
+ *
+ * until the frame table has been set up, pages are taken
+ * from the free pages bitmap handed over by boot32.
+ *
+ * single pages usually have to be cleared before use. to
+ * keep that off the allocation path, the idle task fills
+ * a pool of pages that have already been zeroed.
+ *
+ * page frames can be shared between address spaces (e.g.
+ * after fork()). every frame has a count of additional
+ * references, and releasing a shared frame only drops one
+ * of them.
+ */
+
 #include <mm/memory.h>
 #include <mm/vspace.h>
 #include <util/bitmap.h>
 #include <util/string.h>
 #include <debug.h>
 
-static bitmap_t free_pages;
+#define MAX_ORDER   10
+#define FRAME_NIL   ((uint32_t)-1)
+
+/* number of pages kept in the pre-zeroed pool */
+#define ZERO_POOL_PAGES 256
+
+#define PF_FREE     BIT(0)  // frame is the head of a free block
+#define PF_ZEROED   BIT(1)  // frame is in the pre-zeroed pool
+
+#define DMA32_END_PPN (1ul << (32 - PAGE_SHIFT))
+
+typedef struct
+{
+  /* free list links (page frame numbers) */
+  uint32_t next;
+  uint32_t prev;
+
+  uint8_t order;
+  uint8_t flags;
+
+  /* number of references besides the first one */
+  uint16_t refs;
+} frame_t;
+
+typedef struct
+{
+  const char* name;
+  uint32_t free_lists[MAX_ORDER + 1];
+  size_t free_count;
+} zone_t;
+
+static bitmap_t boot_bitmap;
 static mutex_t free_pages_lock = MUTEX_INITIALIZER;
 
+static frame_t* frames = NULL;
+static size_t total_frames = 0;
+
+static zone_t zones[ZONE_COUNT] = {
+  [ZONE_DMA32] = { .name = "DMA32" },
+  [ZONE_NORMAL] = { .name = "Normal" }
+};
+
+/* pre-zeroed pages, linked through frame_t.next */
+static uint32_t zeroed_list = FRAME_NIL;
+static size_t zeroed_count = 0;
+
+/* a page which has been zeroed by the idle task, but
+ * could not be added to the pool yet */
+static size_t zeroed_pending = (size_t)-1;
+
 void setup_page_bitmap(void* bitmap_addr, size_t size)
 {
-  free_pages.bitmap = bitmap_addr;
-  free_pages.size = size;
+  boot_bitmap.bitmap = bitmap_addr;
+  boot_bitmap.size = size;
+}
+
+static zone_t* page_zone(size_t ppn)
+{
+  if (ppn < DMA32_END_PPN)
+    return &zones[ZONE_DMA32];
+  return &zones[ZONE_NORMAL];
+}
+
+static void list_push(unsigned order, size_t ppn)
+{
+  zone_t* zone = page_zone(ppn);
+  frame_t* frame = &frames[ppn];
+  frame->order = order;
+  frame->flags |= PF_FREE;
+  frame->prev = FRAME_NIL;
+  frame->next = zone->free_lists[order];
+  if (frame->next != FRAME_NIL)
+    frames[frame->next].prev = ppn;
+  zone->free_lists[order] = ppn;
+}
+
+static void list_unlink(unsigned order, size_t ppn)
+{
+  frame_t* frame = &frames[ppn];
+  if (frame->prev != FRAME_NIL)
+    frames[frame->prev].next = frame->next;
+  else
+    page_zone(ppn)->free_lists[order] = frame->next;
+  if (frame->next != FRAME_NIL)
+    frames[frame->next].prev = frame->prev;
+  frame->flags &= ~PF_FREE;
+}
+
+static size_t zone_alloc(zone_t* zone, unsigned order)
+{
+  /* find the smallest free block that is big enough */
+  unsigned current = order;
+  while (current <= MAX_ORDER && zone->free_lists[current] == FRAME_NIL)
+    current++;
+  if (current > MAX_ORDER)
+    return (size_t)-1;
+
+  const size_t ppn = zone->free_lists[current];
+  list_unlink(current, ppn);
+
+  /* split the block until it has the requested
+   * size. the upper halves go back to the lists. */
+  while (current > order)
+  {
+    current--;
+    list_push(current, ppn + (1ul << current));
+  }
+
+  frames[ppn].order = order;
+  zone->free_count -= 1ul << order;
+  return ppn;
+}
+
+static size_t buddy_alloc_zone(int zone, unsigned order)
+{
+  assert(mutex_held(&free_pages_lock), "free pages lock not held");
+
+  /* fall back to the lower zones if the
+   * requested one has run out of memory. */
+  for (int z = zone; z >= 0; z--)
+  {
+    const size_t ppn = zone_alloc(&zones[z], order);
+    if (ppn != (size_t)-1)
+      return ppn;
+  }
+  return (size_t)-1;
 }
 
-size_t alloc_page()
+static size_t buddy_alloc(unsigned order)
 {
+  return buddy_alloc_zone(ZONE_NORMAL, order);
+}
+
+static void buddy_free(size_t ppn, unsigned order)
+{
+  assert(mutex_held(&free_pages_lock), "free pages lock not held");
+  page_zone(ppn)->free_count += 1ul << order;
+
+  /* merge the block with its buddy as long as the
+   * buddy is free and has the same size. */
+  while (order < MAX_ORDER)
+  {
+    const size_t buddy = ppn ^ (1ul << order);
+    if (buddy + (1ul << order) > total_frames)
+      break;
+    if (!(frames[buddy].flags & PF_FREE) || frames[buddy].order != order)
+      break;
+
+    list_unlink(order, buddy);
+    ppn = min(ppn, buddy);
+    order++;
+  }
+
+  list_push(order, ppn);
+}
+
+static void buddy_free_range(size_t ppn, size_t count)
+{
+  /* release an arbitrary run of pages by splitting it
+   * into the biggest naturally aligned blocks possible. */
+  while (count > 0)
+  {
+    unsigned order = 0;
+    while (order < MAX_ORDER &&
+           (ppn & ((2ul << order) - 1)) == 0 &&
+           (2ul << order) <= count)
+      order++;
+
+    buddy_free(ppn, order);
+    ppn += 1ul << order;
+    count -= 1ul << order;
+  }
+}
+
+static int boot_range_free(size_t ppn, size_t count)
+{
+  while (count--)
+  {
+    if (bitmap_get(&boot_bitmap, ppn++))
+      return false;
+  }
+  return true;
+}
+
+void setup_page_frames()
+{
+  /* the frame table itself is allocated on the heap,
+   * which still takes its pages from the boot bitmap. */
+  const size_t count = boot_bitmap.size;
+  frame_t* table = kmalloc(count * sizeof(frame_t));
+  memset(table, 0, count * sizeof(frame_t));
+
   mutex_lock(&free_pages_lock);
-  size_t ppn = bitmap_find_free(&free_pages);
-  kpanic(ppn != (size_t)-1, "alloc_page() out of memory");
-  bitmap_set(&free_pages, ppn);
+  for (int z = 0; z < ZONE_COUNT; z++)
+  {
+    for (unsigned order = 0; order <= MAX_ORDER; order++)
+      zones[z].free_lists[order] = FRAME_NIL;
+  }
+  frames = table;
+  total_frames = count;
+
+  /* seed the free lists from the bitmap: every run of
+   * free pages is split into the biggest naturally
+   * aligned blocks possible. */
+  size_t ppn = 0;
+  while (ppn < count)
+  {
+    if (bitmap_get(&boot_bitmap, ppn))
+    {
+      ppn++;
+      continue;
+    }
+
+    unsigned order = 0;
+    while (order < MAX_ORDER &&
+           (ppn & ((2ul << order) - 1)) == 0 &&
+           ppn + (2ul << order) <= count &&
+           boot_range_free(ppn + (1ul << order), 1ul << order))
+      order++;
+
+    list_push(order, ppn);
+    page_zone(ppn)->free_count += 1ul << order;
+    ppn += 1ul << order;
+  }
   mutex_unlock(&free_pages_lock);
-  memset(ppn_to_virt(ppn), 0, PAGE_SIZE);
+
+  for (int z = 0; z < ZONE_COUNT; z++)
+  {
+    debug(PAGEMGR, "buddy allocator: zone %s has %zu pages free\n",
+          zones[z].name, zones[z].free_count);
+  }
+}
+
+static void zeroed_push(size_t ppn)
+{
+  frames[ppn].flags |= PF_ZEROED;
+  frames[ppn].next = zeroed_list;
+  zeroed_list = ppn;
+  zeroed_count++;
+}
+
+static size_t zeroed_pop()
+{
+  const size_t ppn = zeroed_list;
+  if (ppn == FRAME_NIL)
+    return (size_t)-1;
+
+  zeroed_list = frames[ppn].next;
+  frames[ppn].flags &= ~PF_ZEROED;
+  zeroed_count--;
   return ppn;
 }
 
-void* alloc_dma_region()
+static void zeroed_drain()
+{
+  assert(mutex_held(&free_pages_lock), "free pages lock not held");
+
+  /* give the pool back to the buddy allocator, so
+   * that its pages can be merged into bigger blocks. */
+  size_t ppn;
+  while ((ppn = zeroed_pop()) != (size_t)-1)
+    buddy_free(ppn, 0);
+}
+
+size_t alloc_pages(unsigned order)
 {
-  size_t dma_pages = 16;            // 16P = 64k
-  size_t max_page = 1048576 - 1;    // 1MP = 4GB
+  /* the boot bitmap only hands out single pages, so
+   * there are no blocks before the frame table is set up. */
+  if (!frames || order > MAX_ORDER)
+    return (size_t)-1;
 
   mutex_lock(&free_pages_lock);
-  size_t ppn_start = bitmap_find_n_free(&free_pages, dma_pages);
+  size_t ppn = buddy_alloc(order);
+  if (ppn == (size_t)-1 && zeroed_count > 0)
+  {
+    zeroed_drain();
+    ppn = buddy_alloc(order);
+  }
+  mutex_unlock(&free_pages_lock);
+  return ppn;
+}
 
-  /* validate */
-  if (ppn_start == (size_t)-1 || ppn_start + dma_pages > max_page)
+size_t alloc_page(int flags)
+{
+  size_t ppn;
+  int zeroed = false;
+
+  mutex_lock(&free_pages_lock);
+  if (frames)
+  {
+    /* pages that need to be cleared are taken from
+     * the pre-zeroed pool first, all other ones from
+     * the buddy allocator. each falls back to the other. */
+    if (!(flags & PAGE_NOZERO))
+      zeroed = (ppn = zeroed_pop()) != (size_t)-1;
+    if (!zeroed)
+      ppn = buddy_alloc(0);
+    if (ppn == (size_t)-1)
+      zeroed = (ppn = zeroed_pop()) != (size_t)-1;
+  }
+  else
   {
+    ppn = bitmap_find_free(&boot_bitmap);
+    if (ppn != (size_t)-1)
+      bitmap_set(&boot_bitmap, ppn);
+  }
+  mutex_unlock(&free_pages_lock);
+
+  kpanic(ppn != (size_t)-1, "alloc_page() out of memory");
+  if (!zeroed && !(flags & PAGE_NOZERO))
+    clear_page(ppn_to_virt(ppn));
+  return ppn;
+}
+
+int page_prezero()
+{
+  if (!frames)
+    return false;
+
+  /* this runs in the idle task, which must never be
+   * put asleep. if the lock is taken, try again later.
+   * the page is zeroed without the lock held, so that
+   * allocations don't have to wait for it. */
+  size_t ppn = zeroed_pending;
+  if (ppn == (size_t)-1)
+  {
+    if (zeroed_count >= ZERO_POOL_PAGES ||
+        !mutex_trylock(&free_pages_lock))
+      return false;
+    ppn = buddy_alloc(0);
     mutex_unlock(&free_pages_lock);
-    kpanic(false, "No DMA region could be allocated!");
+    if (ppn == (size_t)-1)
+      return false;
+
+    clear_page(ppn_to_virt(ppn));
+    zeroed_pending = ppn;
+  }
+
+  if (!mutex_trylock(&free_pages_lock))
+    return false;
+  zeroed_push(ppn);
+  zeroed_pending = (size_t)-1;
+  mutex_unlock(&free_pages_lock);
+  return true;
+}
+
+void* alloc_contig(size_t size, size_t align, size_t boundary, int zone)
+{
+  kpanic(frames, "alloc_contig() called before setup_page_frames()");
+  if (size == 0 || zone < 0 || zone >= ZONE_COUNT)
+    return NULL;
+  if (align < PAGE_SIZE)
+    align = PAGE_SIZE;
+  if ((align & (align - 1)) || (boundary & (boundary - 1)))
+    return NULL;
+
+  /* buddy blocks are naturally aligned to their size, so a
+   * block that is at least as big as the alignment satisfies
+   * it. the region starts at the beginning of the block, so
+   * it only crosses a boundary if it is bigger than that. */
+  const size_t count = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  if (boundary && count * PAGE_SIZE > boundary)
+    return NULL;
+
+  unsigned order = 0;
+  while ((1ul << order) < count || ((size_t)PAGE_SIZE << order) < align)
+    order++;
+  if (order > MAX_ORDER)
+    return NULL;
+
+  mutex_lock(&free_pages_lock);
+  size_t ppn = buddy_alloc_zone(zone, order);
+  if (ppn == (size_t)-1 && zeroed_count > 0)
+  {
+    zeroed_drain();
+    ppn = buddy_alloc_zone(zone, order);
+  }
+
+  /* give back the unused tail of the block */
+  if (ppn != (size_t)-1)
+    buddy_free_range(ppn + count, (1ul << order) - count);
+  mutex_unlock(&free_pages_lock);
+
+  if (ppn == (size_t)-1)
+  {
+    debug(PAGEMGR, "no contiguous region of %zu pages in zone %s\n",
+          count, zones[zone].name);
     return NULL;
   }
+  return (void*)(ppn << PAGE_SHIFT);
+}
 
-  /* mark used*/
-  size_t page = ppn_start;
-  while (dma_pages--)
-    bitmap_set(&free_pages, page++);
+void free_contig(void* phys_addr, size_t size)
+{
+  const size_t ppn = (size_t)phys_addr >> PAGE_SHIFT;
+  const size_t count = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  if (ppn + count > total_frames)
+  {
+    assert(false, "contiguous region out of bounds");
+    return;
+  }
 
+  mutex_lock(&free_pages_lock);
+  assert(!(frames[ppn].flags & (PF_FREE|PF_ZEROED)), "double free region");
+  buddy_free_range(ppn, count);
   mutex_unlock(&free_pages_lock);
-  return (void*)(ppn_start << PAGE_SHIFT);
 }
 
-void free_page(size_t page)
+void* alloc_dma_region(size_t size, size_t align, size_t boundary)
+{
+  return alloc_contig(size, align, boundary, ZONE_DMA32);
+}
+
+void free_dma_region(void* phys_addr, size_t size)
+{
+  free_contig(phys_addr, size);
+}
+
+void free_pages(size_t ppn, unsigned order)
 {
-  if (page >= free_pages.size)
+  if (ppn + (1ul << order) > total_frames)
   {
     assert(false, "page out of bounds");
     return;
   }
   mutex_lock(&free_pages_lock);
-  assert(bitmap_get(&free_pages, page) == 1, "double free page");
-  bitmap_clr(&free_pages, page);
+  assert(!(frames[ppn].flags & (PF_FREE|PF_ZEROED)), "double free page");
+  if (frames[ppn].refs > 0)
+  {
+    /* the frame is still used by someone else */
+    assert(order == 0, "shared page block released");
+    frames[ppn].refs--;
+  }
+  else
+  {
+    buddy_free(ppn, order);
+  }
   mutex_unlock(&free_pages_lock);
 }
+
+void free_page(size_t page)
+{
+  free_pages(page, 0);
+}
+
+void page_share(size_t ppn)
+{
+  kpanic(ppn < total_frames, "page_share(): page out of bounds");
+  mutex_lock(&free_pages_lock);
+  kpanic(frames[ppn].refs < (uint16_t)-1, "page_share(): too many references");
+  frames[ppn].refs++;
+  mutex_unlock(&free_pages_lock);
+}
+
+int page_shared(size_t ppn)
+{
+  return ppn < total_frames && frames[ppn].refs > 0;
+}
+
+size_t free_page_count()
+{
+  /* read without the lock, this is only an estimate */
+  size_t count = zeroed_count;
+  for (int z = 0; z < ZONE_COUNT; z++)
+    count += zones[z].free_count;
+  return count;
+}
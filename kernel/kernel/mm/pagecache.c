@@ -0,0 +1,991 @@
+/*
+ * UlmerOS page cache
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * the page cache keeps file contents in page frames.
+ * every file has its own set of cached pages, which is
+ * indexed by page offset with a radix tree. vfs_read()
+ * copies from the cache, and pages mapped into user
+ * processes (program text, file mappings) are shared
+ * straight from it. the cache holds one reference to
+ * each of its frames, mappers hold another. pages that
+ * are not referenced by anyone else are evicted in LRU
+ * order when free memory runs low.
+ *
+ * writes only update the cached pages and mark them
+ * dirty. files with dirty pages are kept on a list, from
+ * which the flusher (see writeback.c) writes them back.
+ * dirty pages and pages being written back are never
+ * evicted. pages which can't be written are dirty again,
+ * and the error is kept until the next fsync() of the
+ * file reports it.
+ *
+ * sequential reads through an fd are detected with the
+ * fd's readahead state. the first sequential miss reads a
+ * whole window synchronously; once the reader is halfway
+ * through a window, the next (twice as large) window is
+ * prefetched by the readahead kernel task, so that the
+ * reader does not have to wait for the disk.
+ */
+
+#include <mm/pagecache.h>
+#include <mm/writeback.h>
+#include <mm/memory.h>
+#include <mm/vspace.h>
+#include <mm/slab.h>
+#include <sched/task.h>
+#include <sched/sched.h>
+#include <arch/common.h>
+#include <util/string.h>
+#include <cmdline.h>
+#include <debug.h>
+#include <errno.h>
+
+#define RADIX_SHIFT       6
+#define RADIX_SLOTS       (1ul << RADIX_SHIFT)
+#define RADIX_MASK        (RADIX_SLOTS - 1)
+#define RADIX_MAX_HEIGHT  ((64 + RADIX_SHIFT - 1) / RADIX_SHIFT)
+
+/* misses are read in runs of up to this many pages */
+#define PAGECACHE_RUN_MAX     32
+
+#define PAGECACHE_EVICT_BATCH 32
+
+/* dirty pages are written back in runs of up to
+ * this many pages. */
+#define WRITEBACK_BATCH       32
+
+/* pending asynchronous readahead requests. if the
+ * queue is full, new requests are dropped. */
+#define READAHEAD_QUEUE     16
+
+typedef struct _rnode_struct
+{
+  void* slots[RADIX_SLOTS];
+  unsigned count;
+} rnode_t;
+
+typedef struct _cpage_struct
+{
+  file_t* file;
+  size_t index;
+  size_t ppn;
+  int dirty;
+  int writeback;
+
+  /* position in the LRU list, protected by lru_lock */
+  struct _cpage_struct* lru_prev;
+  struct _cpage_struct* lru_next;
+} cpage_t;
+
+struct _pcache_struct
+{
+  mutex_t lock;
+  file_t* file;
+  rnode_t* root;
+  unsigned height;
+  size_t pages;
+
+  /* dirty pages are written back with the file
+   * operations of the fd they were written through. */
+  size_t dirty;
+  size_t dirtied;
+  f_ops_t f_ops;
+  void* fs_data;
+  int wb_error;
+
+  /* serializes write-backs of the file, so that an older
+   * copy of a page can't overwrite a newer one on disk.
+   * taken before the cache lock. */
+  mutex_t wb_lock;
+
+  /* position in the list of dirty files,
+   * protected by dirty_lock */
+  int on_dirty_list;
+  struct _pcache_struct* dirty_next;
+};
+
+static kmem_cache_t cpage_cache = KMEM_CACHE_INITIALIZER("cpage_t", sizeof(cpage_t));
+static kmem_cache_t rnode_cache = KMEM_CACHE_INITIALIZER("rnode_t", sizeof(rnode_t));
+static kmem_cache_t pcache_cache = KMEM_CACHE_INITIALIZER("pcache_t", sizeof(pcache_t));
+
+/* all cached pages, most recently used first. the
+ * LRU lock is taken after a file's cache lock. */
+static cpage_t* lru_head = NULL;
+static cpage_t* lru_tail = NULL;
+static mutex_t lru_lock = MUTEX_INITIALIZER;
+
+typedef struct
+{
+  file_t* file;
+  f_ops_t f_ops;
+  void* fs_data;
+  size_t index;
+  size_t count;
+} ra_request_t;
+
+size_t readahead_min = READAHEAD_MIN_DEFAULT;
+size_t readahead_max = READAHEAD_MAX_DEFAULT;
+
+static ra_request_t ra_queue[READAHEAD_QUEUE];
+static size_t ra_queue_head = 0;
+static size_t ra_queue_count = 0;
+static mutex_t ra_queue_lock = MUTEX_INITIALIZER;
+static size_t ra_pending = false;
+static task_t* ra_task = NULL;
+
+/* files with dirty pages. the dirty lock is
+ * taken after a file's cache lock. */
+static pcache_t* dirty_files = NULL;
+static mutex_t dirty_lock = MUTEX_INITIALIZER;
+static size_t dirty_pages = 0;
+
+/* usage statistics */
+static size_t cached_pages = 0;
+static size_t hits = 0;
+static size_t misses = 0;
+static size_t evictions = 0;
+static size_t ra_pages = 0;
+static size_t written_pages = 0;
+static size_t write_errors = 0;
+static size_t ra_dropped = 0;
+
+static size_t radix_max(unsigned height)
+{
+  if (height * RADIX_SHIFT >= 64)
+    return (size_t)-1;
+  return (1ul << (height * RADIX_SHIFT)) - 1;
+}
+
+static rnode_t* rnode_alloc()
+{
+  rnode_t* node = kmem_cache_alloc(&rnode_cache);
+  memset(node, 0, sizeof(rnode_t));
+  return node;
+}
+
+static cpage_t* radix_lookup(pcache_t* pc, size_t index)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  if (pc->root == NULL || index > radix_max(pc->height))
+    return NULL;
+
+  rnode_t* node = pc->root;
+  for (unsigned level = pc->height - 1; level > 0; level--)
+  {
+    node = node->slots[(index >> (level * RADIX_SHIFT)) & RADIX_MASK];
+    if (node == NULL)
+      return NULL;
+  }
+  return node->slots[index & RADIX_MASK];
+}
+
+static void radix_insert(pcache_t* pc, size_t index, cpage_t* page)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  if (pc->root == NULL)
+  {
+    pc->root = rnode_alloc();
+    pc->height = 1;
+  }
+
+  /* grow the tree by adding new roots above
+   * the old one until the index fits. */
+  while (index > radix_max(pc->height))
+  {
+    rnode_t* root = rnode_alloc();
+    root->slots[0] = pc->root;
+    root->count = 1;
+    pc->root = root;
+    pc->height++;
+  }
+
+  rnode_t* node = pc->root;
+  for (unsigned level = pc->height - 1; level > 0; level--)
+  {
+    void** slot = &node->slots[(index >> (level * RADIX_SHIFT)) & RADIX_MASK];
+    if (*slot == NULL)
+    {
+      *slot = rnode_alloc();
+      node->count++;
+    }
+    node = *slot;
+  }
+
+  assert(node->slots[index & RADIX_MASK] == NULL, "page already cached");
+  node->slots[index & RADIX_MASK] = page;
+  node->count++;
+}
+
+static void radix_remove(pcache_t* pc, size_t index)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  rnode_t* path[RADIX_MAX_HEIGHT];
+  rnode_t* node = pc->root;
+  for (unsigned level = pc->height - 1; level > 0; level--)
+  {
+    path[level] = node;
+    node = node->slots[(index >> (level * RADIX_SHIFT)) & RADIX_MASK];
+  }
+  path[0] = node;
+
+  /* nodes that become empty are released bottom-up */
+  for (unsigned level = 0; level < pc->height; level++)
+  {
+    node = path[level];
+    node->slots[(index >> (level * RADIX_SHIFT)) & RADIX_MASK] = NULL;
+    if (--node->count > 0)
+      return;
+    kmem_free(node);
+  }
+
+  pc->root = NULL;
+  pc->height = 0;
+}
+
+static void lru_unlink(cpage_t* page)
+{
+  assert(mutex_held(&lru_lock), "LRU lock not held");
+
+  if (page->lru_prev)
+    page->lru_prev->lru_next = page->lru_next;
+  else
+    lru_head = page->lru_next;
+  if (page->lru_next)
+    page->lru_next->lru_prev = page->lru_prev;
+  else
+    lru_tail = page->lru_prev;
+}
+
+static void lru_push(cpage_t* page)
+{
+  assert(mutex_held(&lru_lock), "LRU lock not held");
+
+  page->lru_prev = NULL;
+  page->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = page;
+  else
+    lru_tail = page;
+  lru_head = page;
+}
+
+static void lru_touch(cpage_t* page)
+{
+  mutex_lock(&lru_lock);
+  lru_unlink(page);
+  lru_push(page);
+  hits++;
+  mutex_unlock(&lru_lock);
+}
+
+static void dirty_list_add(pcache_t* pc)
+{
+  /* put the file on the list of dirty
+   * files, unless it is still on there. */
+  mutex_lock(&dirty_lock);
+  if (!pc->on_dirty_list)
+  {
+    pc->dirty_next = dirty_files;
+    dirty_files = pc;
+    pc->on_dirty_list = true;
+  }
+  mutex_unlock(&dirty_lock);
+}
+
+static void page_dirty(fd_t* fd, pcache_t* pc, cpage_t* page)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  if (page->dirty)
+    return;
+  page->dirty = true;
+  atomic_add(&dirty_pages, 1);
+
+  if (pc->dirty++ == 0)
+  {
+    pc->dirtied = ticks();
+    pc->f_ops = fd->f_ops;
+    pc->fs_data = fd->fs_data;
+    dirty_list_add(pc);
+  }
+}
+
+static void page_redirty(pcache_t* pc, cpage_t* page)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  /* the file keeps its old dirtied time, so the page
+   * is retried by the next periodic flush. */
+  if (page->dirty)
+    return;
+  page->dirty = true;
+  atomic_add(&dirty_pages, 1);
+  if (pc->dirty++ == 0)
+    dirty_list_add(pc);
+}
+
+static pcache_t* file_pcache(file_t* file)
+{
+  if (file->pcache)
+    return file->pcache;
+
+  /* the page cache of a file is created on first use.
+   * whoever comes second drops its copy. */
+  pcache_t* pc = kmem_cache_alloc(&pcache_cache);
+  mutex_init(&pc->lock);
+  mutex_init(&pc->wb_lock);
+  pc->root = NULL;
+  pc->file = file;
+  pc->height = 0;
+  pc->pages = 0;
+  pc->dirty = 0;
+  pc->dirtied = 0;
+  pc->wb_error = SUCCESS;
+  pc->on_dirty_list = false;
+  pc->dirty_next = NULL;
+
+  mutex_lock(&lru_lock);
+  if (file->pcache == NULL)
+  {
+    file->pcache = pc;
+    pc = NULL;
+  }
+  mutex_unlock(&lru_lock);
+
+  if (pc)
+  {
+    mutex_destroy(&pc->lock);
+    mutex_destroy(&pc->wb_lock);
+    kmem_free(pc);
+  }
+  return file->pcache;
+}
+
+static int pagecache_fill(fd_t* fd, pcache_t* pc,
+                          size_t index, size_t count, size_t* ppns)
+{
+  assert(mutex_held(&pc->lock), "page cache lock not held");
+
+  if (fd->f_ops.read == NULL)
+    return -ENOTSUP;
+
+  /* make room before the cache grows any further */
+  if (free_page_count() < PAGECACHE_LOW_WATER)
+    pagecache_reclaim(PAGECACHE_EVICT_BATCH);
+
+  /* consecutive pages are read into physically contiguous
+   * frames, so that a single read request covers them. */
+  size_t first;
+  if (count == 1)
+  {
+    first = alloc_page(PAGE_NOZERO);
+  }
+  else
+  {
+    void* region = alloc_contig(count * PAGE_SIZE, PAGE_SIZE, 0, ZONE_NORMAL);
+    if (region == NULL)
+      return -ENOMEM;
+    first = (size_t)region >> PAGE_SHIFT;
+  }
+
+  /* the file is read through its file system driver
+   * directly, which leaves the file position untouched.
+   * nothing is read beyond the end of the file. */
+  const uint64_t offset = (uint64_t)index << PAGE_SHIFT;
+  size_t read_size = 0;
+  if (fd->file->length > offset)
+    read_size = min(fd->file->length - offset, count * PAGE_SIZE);
+
+  char* data = ppn_to_virt(first);
+  ssize_t bytes = 0;
+  if (read_size > 0)
+    bytes = fd->f_ops.read(fd->fs_data, data, read_size, offset);
+
+  if (bytes < 0)
+  {
+    for (size_t i = 0; i < count; i++)
+      free_page(first + i);
+    return -EIO;
+  }
+
+  /* clear whatever has not been read */
+  memset(data + bytes, 0, count * PAGE_SIZE - bytes);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    cpage_t* page = kmem_cache_alloc(&cpage_cache);
+    page->file = fd->file;
+    page->index = index + i;
+    page->ppn = first + i;
+    page->dirty = false;
+    page->writeback = false;
+    radix_insert(pc, index + i, page);
+    ppns[i] = first + i;
+  }
+
+  mutex_lock(&lru_lock);
+  for (size_t i = 0; i < count; i++)
+    lru_push(radix_lookup(pc, index + i));
+  cached_pages += count;
+  misses += count;
+  mutex_unlock(&lru_lock);
+  pc->pages += count;
+
+  debug(PAGECACHE, "inode %zu: pages %zu-%zu cached in PPN %zu\n",
+        fd->file->inode, index, index + count - 1, first);
+  return SUCCESS;
+}
+
+static int pagecache_fill_run(fd_t* fd, pcache_t* pc, size_t index,
+                              size_t max_count, size_t* ppns)
+{
+  /* read the whole run of missing pages at once. if
+   * there is no contiguous memory, read a single page. */
+  size_t run = 1;
+  while (run < max_count && !radix_lookup(pc, index + run))
+    run++;
+
+  int error = pagecache_fill(fd, pc, index, run, ppns);
+  if (error == -ENOMEM)
+    error = pagecache_fill(fd, pc, index, run = 1, ppns);
+  return error < 0 ? error : (int)run;
+}
+
+int pagecache_get_range(fd_t* fd, size_t index, size_t count, size_t* ppns)
+{
+  /* pages are read while holding the file's cache
+   * lock, so concurrent faults on the same page can't
+   * load it twice. */
+  pcache_t* pc = file_pcache(fd->file);
+  mutex_lock(&pc->lock);
+  size_t i = 0;
+  while (i < count)
+  {
+    cpage_t* page = radix_lookup(pc, index + i);
+    if (page)
+    {
+      lru_touch(page);
+      ppns[i++] = page->ppn;
+      continue;
+    }
+
+    int run = pagecache_fill_run(fd, pc, index + i, count - i, &ppns[i]);
+    if (run < 0)
+    {
+      mutex_unlock(&pc->lock);
+      return run;
+    }
+    i += run;
+  }
+
+  /* hand out an additional reference to the caller */
+  for (i = 0; i < count; i++)
+    page_share(ppns[i]);
+  mutex_unlock(&pc->lock);
+  return SUCCESS;
+}
+
+int pagecache_get(fd_t* fd, size_t index, size_t* ppn)
+{
+  return pagecache_get_range(fd, index, 1, ppn);
+}
+
+void readahead_reset(readahead_t* ra)
+{
+  ra->start = 0;
+  ra->size = 0;
+  ra->marker = 0;
+  ra->prev_index = 0;
+}
+
+static void readahead_submit(fd_t* fd, size_t index, size_t count)
+{
+  if (ra_task == NULL)
+    return;
+
+  mutex_lock(&ra_queue_lock);
+  if (ra_queue_count == READAHEAD_QUEUE)
+  {
+    ra_dropped++;
+    mutex_unlock(&ra_queue_lock);
+    return;
+  }
+
+  ra_request_t* req = &ra_queue[(ra_queue_head + ra_queue_count) % READAHEAD_QUEUE];
+  req->file = fd->file;
+  req->f_ops = fd->f_ops;
+  req->fs_data = fd->fs_data;
+  req->index = index;
+  req->count = count;
+  ra_queue_count++;
+  mutex_unlock(&ra_queue_lock);
+
+  ra_pending = true;
+  irq_signal(ra_task);
+}
+
+static size_t readahead(fd_t* fd, size_t index, size_t last_index)
+{
+  /* the readahead state is only a hint, so concurrent
+   * readers of the same fd may update it unprotected.
+   * returns the end of the range to read synchronously. */
+  readahead_t* ra = &fd->ra;
+  const size_t eof = (fd->file->length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  const int sequential = index == 0 || index == ra->prev_index ||
+        index == ra->prev_index + 1;
+  ra->prev_index = last_index;
+
+  if (readahead_max == 0 || !sequential)
+  {
+    ra->size = 0;
+    return last_index + 1;
+  }
+
+  if (ra->size == 0 || index < ra->start || index >= ra->start + ra->size)
+  {
+    /* start a new window at the current position. it
+     * is read right away, the reader is waiting for it. */
+    size_t size = readahead_min;
+    while (size < last_index - index + 1 && size < readahead_max)
+      size *= 2;
+    ra->start = index;
+    ra->size = min(size, readahead_max);
+    ra->marker = ra->start + ra->size / 2;
+    return ra->start + ra->size;
+  }
+
+  if (last_index >= ra->marker)
+  {
+    /* the reader has entered the second half of the
+     * window, prefetch the next one in the background. */
+    ra->start += ra->size;
+    ra->size = min(ra->size * 2, readahead_max);
+    ra->marker = ra->start;
+    if (ra->start < eof)
+      readahead_submit(fd, ra->start, min(ra->size, eof - ra->start));
+  }
+  return last_index + 1;
+}
+
+static void readahead_fill(fd_t* fd, size_t index, size_t count)
+{
+  pcache_t* pc = file_pcache(fd->file);
+  size_t ppns[PAGECACHE_RUN_MAX];
+  size_t i = 0;
+  while (i < count)
+  {
+    mutex_lock(&pc->lock);
+    if (radix_lookup(pc, index + i))
+    {
+      mutex_unlock(&pc->lock);
+      i++;
+      continue;
+    }
+
+    const size_t max_count = min(count - i, PAGECACHE_RUN_MAX);
+    int run = pagecache_fill_run(fd, pc, index + i, max_count, ppns);
+    mutex_unlock(&pc->lock);
+    if (run < 0)
+      return;
+
+    atomic_add(&ra_pages, run);
+    i += run;
+  }
+}
+
+static void readahead_task_func()
+{
+  for (;;)
+  {
+    irq_wait_until(&ra_pending, true);
+    ra_pending = false;
+
+    for (;;)
+    {
+      mutex_lock(&ra_queue_lock);
+      if (ra_queue_count == 0)
+      {
+        mutex_unlock(&ra_queue_lock);
+        break;
+      }
+      ra_request_t req = ra_queue[ra_queue_head];
+      ra_queue_head = (ra_queue_head + 1) % READAHEAD_QUEUE;
+      ra_queue_count--;
+      mutex_unlock(&ra_queue_lock);
+
+      /* fds are never released, but the request does
+       * not depend on that. it brings everything that
+       * is needed to read the file. */
+      fd_t fd;
+      fd.file = req.file;
+      fd.fpos = 0;
+      fd.f_ops = req.f_ops;
+      fd.fs_data = req.fs_data;
+
+      debug(PAGECACHE, "readahead: inode %zu, pages %zu-%zu\n",
+            req.file->inode, req.index, req.index + req.count - 1);
+      readahead_fill(&fd, req.index, req.count);
+    }
+  }
+}
+
+static size_t readahead_param(const char* name, size_t value)
+{
+  const char* param = cmdline_get(name);
+  if (param == NULL)
+    return value;
+
+  /* window sizes are powers of two */
+  value = min(strtoul(param, NULL, 10), READAHEAD_LIMIT);
+  while (value & (value - 1))
+    value &= value - 1;
+  return value;
+}
+
+void pagecache_init()
+{
+  readahead_max = readahead_param("readahead", readahead_max);
+  readahead_min = readahead_param("readahead_min", readahead_min);
+  if (readahead_min == 0)
+    readahead_min = 1;
+  readahead_min = min(readahead_min, max(readahead_max, 1));
+  debug(INIT, "readahead window: %zu-%zu pages\n",
+        readahead_min, readahead_max);
+
+  if (readahead_max > 0)
+  {
+    ra_task = create_kernel_task(readahead_task_func);
+    sched_insert(ra_task);
+  }
+}
+
+ssize_t pagecache_read(fd_t* fd, void* buffer, size_t len, uint64_t offset)
+{
+  file_t* file = fd->file;
+  if (offset >= file->length)
+    return 0;
+  len = min(len, file->length - offset);
+
+  pcache_t* pc = file_pcache(file);
+  const size_t first_index = offset >> PAGE_SHIFT;
+  const size_t last_index = (offset + len - 1) >> PAGE_SHIFT;
+  const size_t eof = (file->length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  const size_t fill_end = min(readahead(fd, first_index, last_index), eof);
+  size_t copied = 0;
+  while (copied < len)
+  {
+    const size_t index = (offset + copied) >> PAGE_SHIFT;
+
+    /* the page is referenced while its contents are
+     * copied, which keeps it from being evicted. the
+     * lock is not held, as the buffer might fault. */
+    mutex_lock(&pc->lock);
+    cpage_t* page = radix_lookup(pc, index);
+    size_t ppn;
+    if (page)
+    {
+      lru_touch(page);
+      ppn = page->ppn;
+    }
+    else
+    {
+      size_t ppns[PAGECACHE_RUN_MAX];
+      const size_t max_count = min(fill_end - index, PAGECACHE_RUN_MAX);
+      int run = pagecache_fill_run(fd, pc, index, max_count, ppns);
+      if (run < 0)
+      {
+        mutex_unlock(&pc->lock);
+        return copied > 0 ? (ssize_t)copied : run;
+      }
+      ppn = ppns[0];
+    }
+    page_share(ppn);
+    mutex_unlock(&pc->lock);
+
+    const size_t page_offset = (offset + copied) % PAGE_SIZE;
+    const size_t bytes = min(PAGE_SIZE - page_offset, len - copied);
+    memcpy((char*)buffer + copied, (char*)ppn_to_virt(ppn) + page_offset, bytes);
+    free_page(ppn);
+    copied += bytes;
+  }
+
+  return copied;
+}
+
+static int pcache_writeback(pcache_t* pc);
+
+ssize_t pagecache_write(fd_t* fd, const void* buffer, size_t len, uint64_t offset)
+{
+  if (len == 0)
+    return 0;
+
+  pcache_t* pc = file_pcache(fd->file);
+  size_t copied = 0;
+  while (copied < len)
+  {
+    const size_t index = (offset + copied) >> PAGE_SHIFT;
+
+    /* pages are brought in before they are modified, as
+     * the parts that are not overwritten must stay valid.
+     * nothing is read beyond the end of the file. */
+    mutex_lock(&pc->lock);
+    cpage_t* page = radix_lookup(pc, index);
+    size_t ppn;
+    if (page)
+    {
+      lru_touch(page);
+      ppn = page->ppn;
+    }
+    else
+    {
+      int error = pagecache_fill(fd, pc, index, 1, &ppn);
+      if (error < 0)
+      {
+        mutex_unlock(&pc->lock);
+        return copied > 0 ? (ssize_t)copied : error;
+      }
+    }
+    page_share(ppn);
+    mutex_unlock(&pc->lock);
+
+    const size_t page_offset = (offset + copied) % PAGE_SIZE;
+    const size_t bytes = min(PAGE_SIZE - page_offset, len - copied);
+    memcpy((char*)ppn_to_virt(ppn) + page_offset, (char*)buffer + copied, bytes);
+    copied += bytes;
+
+    /* the page is marked dirty only after it has been
+     * modified, so that a write-back which runs at the
+     * same time can't clear the dirty state too early.
+     * our reference keeps the page in the cache. */
+    mutex_lock(&pc->lock);
+    page_dirty(fd, pc, radix_lookup(pc, index));
+    if (offset + copied > fd->file->length)
+      fd->file->length = offset + copied;
+    mutex_unlock(&pc->lock);
+    free_page(ppn);
+  }
+
+  /* writers that produce dirty pages faster than they
+   * can be written back have to write back themselves.
+   * errors are left for fsync() to report. */
+  if (dirty_pages > DIRTY_LIMIT_PAGES)
+    pcache_writeback(pc);
+  else if (dirty_pages > DIRTY_BACKGROUND_PAGES)
+    writeback_wakeup();
+  return copied;
+}
+
+static int pcache_writeback(pcache_t* pc)
+{
+  char* bounce = kmalloc(WRITEBACK_BATCH * PAGE_SIZE);
+  int error = SUCCESS;
+  size_t index = 0;
+  mutex_lock(&pc->wb_lock);
+  for (;;)
+  {
+    /* find the next dirty page and collect the run of
+     * dirty pages that follows it. the pages are copied
+     * and marked clean before the lock is dropped, so
+     * that writers can go on modifying them. they can't
+     * be evicted until the write has completed. pages
+     * still under write-back are left for the next run. */
+    mutex_lock(&pc->lock);
+    const size_t end = (pc->file->length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    cpage_t* page = NULL;
+    while (pc->dirty > 0 && index < end &&
+           !((page = radix_lookup(pc, index)) && page->dirty &&
+             !page->writeback))
+      index++;
+    if (pc->dirty == 0 || index >= end)
+    {
+      mutex_unlock(&pc->lock);
+      break;
+    }
+
+    const size_t first = index;
+    size_t count = 0;
+    while (count < WRITEBACK_BATCH && index < end &&
+           (page = radix_lookup(pc, index)) && page->dirty &&
+           !page->writeback)
+    {
+      memcpy(bounce + count * PAGE_SIZE, ppn_to_virt(page->ppn), PAGE_SIZE);
+      page->dirty = false;
+      page->writeback = true;
+      count++;
+      index++;
+    }
+    pc->dirty -= count;
+
+    /* nothing is written beyond the end of the file */
+    const uint64_t offset = (uint64_t)first << PAGE_SHIFT;
+    const size_t len = min(count * PAGE_SIZE, pc->file->length - offset);
+    const f_ops_t f_ops = pc->f_ops;
+    void* fs_data = pc->fs_data;
+    mutex_unlock(&pc->lock);
+
+    ssize_t written = f_ops.write(fs_data, bounce, len, offset);
+    atomic_add(&dirty_pages, -count);
+    const int failed = written < (ssize_t)len;
+
+    /* pages which couldn't be written are dirty
+     * again and will be retried later on. */
+    mutex_lock(&pc->lock);
+    for (size_t i = first; i < first + count; i++)
+    {
+      page = radix_lookup(pc, i);
+      assert(page && page->writeback, "page evicted during write-back");
+      page->writeback = false;
+      if (failed)
+        page_redirty(pc, page);
+    }
+    if (failed)
+      pc->wb_error = -EIO;
+    mutex_unlock(&pc->lock);
+
+    if (failed)
+    {
+      debug(PAGECACHE, "inode %zu: write-back of pages %zu-%zu failed\n",
+            pc->file->inode, first, first + count - 1);
+      atomic_add(&write_errors, 1);
+      error = -EIO;
+      continue;
+    }
+    atomic_add(&written_pages, count);
+  }
+  mutex_unlock(&pc->wb_lock);
+
+  kfree(bounce);
+  return error;
+}
+
+static void sort_by_inode(pcache_t** list)
+{
+  /* insertion sort, the list of dirty files is short */
+  pcache_t* sorted = NULL;
+  while (*list)
+  {
+    pcache_t* pc = *list;
+    *list = pc->dirty_next;
+
+    pcache_t** link = &sorted;
+    while (*link && (*link)->file->inode < pc->file->inode)
+      link = &(*link)->dirty_next;
+    pc->dirty_next = *link;
+    *link = pc;
+  }
+  *list = sorted;
+}
+
+int pagecache_writeback(size_t min_age)
+{
+  /* take the whole list. files which are still dirty
+   * afterwards are put back. */
+  mutex_lock(&dirty_lock);
+  pcache_t* list = dirty_files;
+  dirty_files = NULL;
+  mutex_unlock(&dirty_lock);
+
+  sort_by_inode(&list);
+
+  int error = SUCCESS;
+  const size_t now = ticks();
+  while (list)
+  {
+    pcache_t* pc = list;
+    list = pc->dirty_next;
+
+    if (pc->dirty > 0 && now - pc->dirtied >= min_age &&
+        pcache_writeback(pc) < 0)
+      error = -EIO;
+
+    mutex_lock(&pc->lock);
+    mutex_lock(&dirty_lock);
+    if (pc->dirty > 0)
+    {
+      pc->dirty_next = dirty_files;
+      dirty_files = pc;
+    }
+    else
+    {
+      pc->on_dirty_list = false;
+    }
+    mutex_unlock(&dirty_lock);
+    mutex_unlock(&pc->lock);
+  }
+  return error;
+}
+
+int pagecache_fsync(file_t* file)
+{
+  /* the file stays on the dirty list, the next
+   * write-back takes it off. errors of earlier
+   * write-backs are reported (once) as well. */
+  pcache_t* pc = file->pcache;
+  if (pc == NULL)
+    return SUCCESS;
+
+  int error = pcache_writeback(pc);
+  mutex_lock(&pc->lock);
+  if (pc->wb_error < 0)
+    error = pc->wb_error;
+  pc->wb_error = SUCCESS;
+  mutex_unlock(&pc->lock);
+  return error;
+}
+
+size_t pagecache_dirty()
+{
+  return dirty_pages;
+}
+
+size_t pagecache_reclaim(size_t count)
+{
+  /* walk the LRU list from the least recently used
+   * page. pages which are mapped somewhere (or whose
+   * file is busy) are skipped. */
+  size_t freed = 0;
+  mutex_lock(&lru_lock);
+  cpage_t* page = lru_tail;
+  while (page && freed < count)
+  {
+    cpage_t* prev = page->lru_prev;
+    pcache_t* pc = page->file->pcache;
+    if (mutex_trylock(&pc->lock))
+    {
+      if (!page->dirty && !page->writeback && !page_shared(page->ppn))
+      {
+        lru_unlink(page);
+        radix_remove(pc, page->index);
+        pc->pages--;
+        cached_pages--;
+        evictions++;
+
+        free_page(page->ppn);
+        kmem_free(page);
+        freed++;
+      }
+      mutex_unlock(&pc->lock);
+    }
+    page = prev;
+  }
+  mutex_unlock(&lru_lock);
+
+  debug(PAGECACHE, "reclaimed %zu pages\n", freed);
+  return freed;
+}
+
+void pagecache_print()
+{
+  const unsigned loglevel = PAGECACHE|OUTPUT_ENABLED;
+  debug(loglevel, "-- page cache: %zu pages (%zu KiB), %zu hits, "
+        "%zu misses, %zu evictions\n", cached_pages,
+        cached_pages * PAGE_SIZE >> 10, hits, misses, evictions);
+  debug(loglevel, "   readahead: %zu pages prefetched, %zu requests "
+        "dropped\n", ra_pages, ra_dropped);
+  debug(loglevel, "   write-back: %zu dirty pages, %zu pages written, "
+        "%zu errors\n", dirty_pages, written_pages, write_errors);
+}
@@ -1,8 +1,45 @@
 #include <util/types.h>
+#include <util/string.h>
 #include <debug.h>
+#include <cmdline.h>
 #include <sched/task.h>
-#include <sched/userstack.h>
+#include <sched/proc.h>
+#include <arch/common.h>
 #include <mm/memory.h>
+#include <mm/vspace.h>
+#include <mm/vma.h>
+
+size_t fault_around_pages = FAULT_AROUND_DEFAULT;
+
+void fault_around_init()
+{
+  const char* param = cmdline_get("faultaround");
+  if (param == NULL)
+    return;
+
+  size_t pages = strtoul(param, NULL, 10);
+  if (pages == 0)
+    pages = 1;
+  pages = min(pages, FAULT_AROUND_MAX);
+
+  /* only keep the highest bit, so that windows
+   * can be aligned to their size. */
+  while (pages & (pages - 1))
+    pages &= pages - 1;
+
+  fault_around_pages = pages;
+  debug(INIT, "fault-around window: %zu pages\n", pages);
+}
+
+size_t fault_around(size_t virt_page, size_t first, size_t end, size_t* start)
+{
+  assert(virt_page >= first && virt_page < end,
+         "fault_around(): page outside of region");
+
+  const size_t window = virt_page & ~(fault_around_pages - 1);
+  *start = max(window, first);
+  return min(window + fault_around_pages, end) - *start;
+}
 
 static const char* bool_str(int bool)
 {
@@ -19,19 +56,20 @@ int page_fault(size_t address, int present, int write, int user, int exec)
   if (!current_task || !current_task->process)
     return false;
   proc_t* process = current_task->process;
+  atomic_add(&process->faults, 1);
 
-  /* check whether the fault is caused by reading or
-   * writing to a userspace stack page. */
-  if (stack_load(process, virt_page) >= 0)
-    return true;
-
-  if (heap_load(process, address) >= 0)
-    return true;
-
-  /* check whether the fault is caused by a missing code
-   * or data page. it will be reloaded from the binary. */
-  if (loader_load(process->loader, virt_page, current_task->vspace) >= 0)
+  /* look up the memory area (stack, heap, segment of
+   * the binary, mapping, ...) the address belongs to. its
+   * fault handler maps neighbouring pages as well and
+   * returns how many pages were mapped. writing to a
+   * present page is only allowed if it is a copy-on-write
+   * page in a writable area. */
+  int pages = vma_fault(process, virt_page, present, write, exec);
+  if (pages >= 0)
+  {
+    atomic_add(&process->fault_pages, pages);
     return true;
+  }
 
   return false;
 }
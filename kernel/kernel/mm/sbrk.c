@@ -11,56 +11,116 @@ void* sys_sbrk(ssize_t increment)
 {
   /* some sanity checks */
   proc_t* process = current_task->process;
-  if (process->heap_brk == (size_t)-1)
+  if (process->heap_vma == NULL)
     return (void*)-1;
   assert(process->loader, "sbrk(): process has invalid loader_t");
 
   /* get some values */
   const size_t min_heap_break = process->loader->min_heap_break;
+  mutex_lock(&process->heap_lock);
   void* old_break = (void*)process->heap_brk;
 
-  mutex_lock(&process->heap_lock);
+  size_t new_break = process->heap_brk + increment;
   if (process->heap_brk + increment < min_heap_break)
-    process->heap_brk = min_heap_break;
-  else
-    process->heap_brk = process->heap_brk + increment;
+    new_break = min_heap_break;
+
+  /* the heap area is resized with the area tree locked
+   * for writing, so no fault handler can run meanwhile.
+   * it must not grow into any other area. */
+  vma_t* heap = process->heap_vma;
+  const size_t new_end = (new_break + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  rwlock_write_lock(&process->vma_lock);
+  if (new_end > heap->end && vma_overlap(process, heap->end, new_end))
+  {
+    rwlock_write_unlock(&process->vma_lock);
+    mutex_unlock(&process->heap_lock);
+    return (void*)-1;
+  }
 
   debug(SYSCALL, "sys_sbrk(): moving heap break %p -> %p (%zd)\n",
-        old_break, process->heap_brk, increment);
+        old_break, new_break, increment);
 
   /* if the sbrk() call is used to deallocate memory,
    * the corresponding pages are unmapped and further
    * references to them are considered invalid. */
-  if (increment < 0)
-  {
-    size_t first_unmap = process->heap_brk >> PAGE_SHIFT;
-    if (process->heap_brk % PAGE_SIZE != 0)
-      first_unmap += 1;
+  if (new_end < heap->end)
+    vspace_unmap_range(process->vspace, new_end, heap->end - new_end);
+
+  heap->end = new_end;
+  process->heap_brk = new_break;
+  rwlock_write_unlock(&process->vma_lock);
+  mutex_unlock(&process->heap_lock);
+  return old_break;
+}
+
+static int heap_load_huge(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  assert(rwlock_held(&proc->vma_lock), "VMA tree not locked");
 
-    size_t last_unmap = (size_t)old_break >> PAGE_SHIFT;
-    if ((size_t)old_break % PAGE_SIZE == 0)
-      last_unmap -= 1;
+  /* a huge page can only be used if the aligned 2 MiB
+   * region around the address lies entirely inside the heap. */
+  const size_t start = virt_page & ~(HUGE_PAGE_PAGES - 1);
+  if (start < vma->start || start + HUGE_PAGE_PAGES > vma->end)
+    return false;
 
-    for (size_t page = first_unmap; page <= last_unmap; page++)
-      vspace_unmap(process->vspace, page);
+  const size_t ppn = alloc_pages(HUGE_PAGE_ORDER);
+  if (ppn == (size_t)-1)
+    return false;
+
+  for (size_t i = 0; i < HUGE_PAGE_PAGES; i++)
+    clear_page(ppn_to_virt(ppn + i));
+
+  /* if parts of the region have already been mapped,
+   * stick to single pages. */
+  if (vspace_map_huge(proc->vspace, start, ppn, PG_WRITE|PG_USER) < 0)
+  {
+    free_pages(ppn, HUGE_PAGE_ORDER);
+    return false;
   }
 
-  mutex_unlock(&process->heap_lock);
-  return old_break;
+  debug(LOADER, "PID %zu: heap: mapping huge page %zu @ %p\n",
+        proc->pid, ppn, start << PAGE_SHIFT);
+  return true;
+}
+
+static int heap_fault(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  if (heap_load_huge(proc, vma, virt_page))
+    return HUGE_PAGE_PAGES;
+
+  /* map the neighbouring pages inside the
+   * heap as well (fault-around). */
+  size_t start;
+  const size_t count = fault_around(virt_page, vma->start, vma->end, &start);
+  debug(LOADER, "PID %zu: heap: mapping %zu pages @ %p\n",
+        proc->pid, count, start << PAGE_SHIFT);
+  return vspace_map_range(proc->vspace, start, count, PG_WRITE|PG_USER);
 }
 
-int heap_load(proc_t* proc, size_t addr)
+static const vma_ops_t heap_vma_ops = {
+  .name = "heap",
+  .fault = heap_fault
+};
+
+void heap_init(proc_t* proc)
 {
-  int ret = -ENOENT;
-  mutex_lock(&proc->heap_lock);
-  if (addr >= proc->loader->min_heap_break && addr < proc->heap_brk)
+  /* there is no heap if the loader could not
+   * determine where it starts. */
+  const size_t min_heap_break = proc->loader->min_heap_break;
+  if (min_heap_break == (size_t)-1)
   {
-    size_t ppn = alloc_page();
-    debug(LOADER, "PID %zu: heap: mapping page %zu @ %p\n",
-          proc->pid, ppn, addr & ~0xfff);
-    vspace_map(proc->vspace, addr >> PAGE_SHIFT, ppn, PG_WRITE|PG_USER);
-    ret = SUCCESS;
+    proc->heap_vma = NULL;
+    return;
   }
-  mutex_unlock(&proc->heap_lock);
-  return ret;
+
+  /* the heap area is not inherited by forked children,
+   * they create their own one. */
+  proc->heap_vma = vma_create(min_heap_break >> PAGE_SHIFT,
+      (proc->heap_brk + PAGE_SIZE - 1) >> PAGE_SHIFT,
+      PG_WRITE, VMA_NOFORK, &heap_vma_ops, NULL);
+
+  rwlock_write_lock(&proc->vma_lock);
+  int error = vma_insert(proc, proc->heap_vma);
+  rwlock_write_unlock(&proc->vma_lock);
+  kpanic(error == SUCCESS, "heap overlaps another memory area");
 }
@@ -0,0 +1,230 @@
+/*
+ * UlmerOS slab allocator
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * objects of the same size (or type) are grouped into
+ * slabs, which are single page frames accessed through
+ * the identity mapping. each slab starts with a slab_t
+ * header followed by the objects. free objects are kept
+ * in a singly-linked freelist inside the slab, which
+ * makes both allocation and release O(1).
+ */
+
+#include <mm/slab.h>
+#include <mm/memory.h>
+#include <mm/vspace.h>
+#include <arch/common.h>
+#include <debug.h>
+
+#define SLAB_MAGIC        0x51ab51abu
+#define SLAB_HEADER_SIZE  SLAB_ALIGN(sizeof(slab_t))
+
+struct _slab_struct
+{
+  unsigned magic;
+  unsigned inuse;
+  size_t ppn;
+  kmem_cache_t* cache;
+  void* freelist;
+  struct _slab_struct* prev;
+  struct _slab_struct* next;
+};
+
+/* the kmalloc() size classes. anything not larger
+ * than SLAB_MAX_SIZE will be rounded up to the next
+ * size class. */
+static kmem_cache_t size_caches[] = {
+  KMEM_CACHE_INITIALIZER("kmalloc-16", 16),
+  KMEM_CACHE_INITIALIZER("kmalloc-32", 32),
+  KMEM_CACHE_INITIALIZER("kmalloc-64", 64),
+  KMEM_CACHE_INITIALIZER("kmalloc-96", 96),
+  KMEM_CACHE_INITIALIZER("kmalloc-128", 128),
+  KMEM_CACHE_INITIALIZER("kmalloc-192", 192),
+  KMEM_CACHE_INITIALIZER("kmalloc-256", 256),
+  KMEM_CACHE_INITIALIZER("kmalloc-512", 512),
+  KMEM_CACHE_INITIALIZER("kmalloc-1024", 1024),
+};
+
+#define SIZE_CACHES (sizeof(size_caches) / sizeof(kmem_cache_t))
+
+static kmem_cache_t* cache_list = NULL;
+static mutex_t cache_list_lock = MUTEX_INITIALIZER;
+
+static void slab_link(slab_t** list, slab_t* slab)
+{
+  slab->prev = NULL;
+  slab->next = *list;
+  if (*list)
+    (*list)->prev = slab;
+  *list = slab;
+}
+
+static void slab_unlink(slab_t** list, slab_t* slab)
+{
+  if (slab->prev)
+    slab->prev->next = slab->next;
+  else
+    *list = slab->next;
+  if (slab->next)
+    slab->next->prev = slab->prev;
+  slab->prev = NULL;
+  slab->next = NULL;
+}
+
+static void cache_register(kmem_cache_t* cache)
+{
+  mutex_lock(&cache_list_lock);
+  cache->next = cache_list;
+  cache_list = cache;
+  cache->registered = true;
+  mutex_unlock(&cache_list_lock);
+}
+
+static slab_t* slab_grow(kmem_cache_t* cache)
+{
+  assert(mutex_held(&cache->lock), "cache lock not held");
+
+  if (!cache->registered)
+  {
+    cache->objs_per_slab = (PAGE_SIZE - SLAB_HEADER_SIZE) / cache->obj_size;
+    kpanic(cache->objs_per_slab > 0, "slab: object size too big");
+    cache_register(cache);
+  }
+
+  /* slabs are accessed through the identity mapping,
+   * so there is no need to touch any page tables. the
+   * object memory is not cleared, neither is the page. */
+  const size_t ppn = alloc_page(PAGE_NOZERO);
+  slab_t* slab = ppn_to_virt(ppn);
+  slab->magic = SLAB_MAGIC;
+  slab->inuse = 0;
+  slab->ppn = ppn;
+  slab->cache = cache;
+
+  /* build the freelist of the new slab */
+  char* obj = (char*)slab + SLAB_HEADER_SIZE;
+  slab->freelist = obj;
+  for (size_t i = 0; i < cache->objs_per_slab - 1; i++)
+  {
+    *(void**)obj = obj + cache->obj_size;
+    obj += cache->obj_size;
+  }
+  *(void**)obj = NULL;
+
+  slab_link(&cache->empty, slab);
+  cache->slab_count++;
+
+  debug(KHEAP, "slab: cache %s grows to %zu slabs\n",
+        cache->name, cache->slab_count);
+  return slab;
+}
+
+void* kmem_cache_alloc(kmem_cache_t* cache)
+{
+  mutex_lock(&cache->lock);
+
+  /* prefer partially used slabs, so that empty
+   * ones can be given back if possible. */
+  slab_t* slab = cache->partial;
+  if (slab == NULL)
+  {
+    slab = cache->empty;
+    if (slab == NULL)
+      slab = slab_grow(cache);
+    slab_unlink(&cache->empty, slab);
+    slab_link(&cache->partial, slab);
+  }
+
+  void* obj = slab->freelist;
+  assert(obj, "slab: partial slab has no free objects");
+  slab->freelist = *(void**)obj;
+  slab->inuse++;
+
+  if (slab->inuse == cache->objs_per_slab)
+  {
+    slab_unlink(&cache->partial, slab);
+    slab_link(&cache->full, slab);
+  }
+
+  cache->objs_inuse++;
+  cache->allocs++;
+  mutex_unlock(&cache->lock);
+  return obj;
+}
+
+void kmem_free(void* obj)
+{
+  slab_t* slab = (slab_t*)((size_t)obj & ~(size_t)(PAGE_SIZE - 1));
+  if (slab->magic != SLAB_MAGIC)
+    kpanic(false, "slab: freeing object with invalid slab header");
+
+  kmem_cache_t* cache = slab->cache;
+  assert(((char*)obj - (char*)slab - SLAB_HEADER_SIZE) % cache->obj_size == 0,
+         "slab: freeing misaligned object");
+
+  mutex_lock(&cache->lock);
+  assert(slab->inuse > 0, "slab: double free");
+
+  const int was_full = slab->inuse == cache->objs_per_slab;
+  *(void**)obj = slab->freelist;
+  slab->freelist = obj;
+  slab->inuse--;
+
+  if (was_full)
+  {
+    slab_unlink(&cache->full, slab);
+    slab_link(&cache->partial, slab);
+  }
+
+  if (slab->inuse == 0)
+  {
+    slab_unlink(&cache->partial, slab);
+
+    /* keep a single empty slab around to avoid
+     * allocating and releasing a page over and over
+     * again when a cache is about to run empty. */
+    if (cache->empty == NULL)
+    {
+      slab_link(&cache->empty, slab);
+    }
+    else
+    {
+      slab->magic = 0;
+      cache->slab_count--;
+      free_page(slab->ppn);
+    }
+  }
+
+  cache->objs_inuse--;
+  cache->frees++;
+  mutex_unlock(&cache->lock);
+}
+
+kmem_cache_t* kmem_size_cache(size_t size)
+{
+  for (size_t i = 0; i < SIZE_CACHES; i++)
+  {
+    if (size <= size_caches[i].obj_size)
+      return &size_caches[i];
+  }
+  return NULL;
+}
+
+void kmem_cache_print()
+{
+  const unsigned loglevel = KHEAP|OUTPUT_ENABLED;
+
+  /* statistics are read without taking the cache
+   * locks, so they might be slightly inaccurate. */
+  mutex_lock(&cache_list_lock);
+  debug(loglevel, "-- slab caches:\n");
+  for (kmem_cache_t* cache = cache_list; cache != NULL; cache = cache->next)
+  {
+    const size_t total = cache->slab_count * cache->objs_per_slab;
+    debug(loglevel, "  %s: %zu/%zu objects (%zu bytes) in %zu slabs, "
+          "%zu allocs, %zu frees\n", cache->name, cache->objs_inuse,
+          total, cache->obj_size, cache->slab_count,
+          cache->allocs, cache->frees);
+  }
+  mutex_unlock(&cache_list_lock);
+}
@@ -0,0 +1,309 @@
+/*
+ * UlmerOS virtual memory areas
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * every process keeps the areas of its address space
+ * (stacks, heap, ELF segments, ...) in an AVL tree, so
+ * that a page fault can be classified with a single
+ * O(log n) lookup. areas never overlap, which makes the
+ * tree ordered by both start and end page.
+ */
+
+#include <mm/vma.h>
+#include <mm/vspace.h>
+#include <mm/slab.h>
+#include <sched/proc.h>
+#include <debug.h>
+#include <errno.h>
+
+static kmem_cache_t vma_cache = KMEM_CACHE_INITIALIZER("vma_t", sizeof(vma_t));
+
+static int vma_height(vma_t* node)
+{
+  return node ? node->height : 0;
+}
+
+static void vma_update(vma_t* node)
+{
+  node->height = 1 + max(vma_height(node->left), vma_height(node->right));
+}
+
+/* areas are ordered by start page. empty areas (like
+ * the heap before the first sbrk()) may share their start
+ * with another area, so ties are broken by end page and
+ * address to keep the order strict. */
+static int vma_before(vma_t* a, vma_t* b)
+{
+  if (a->start != b->start)
+    return a->start < b->start;
+  if (a->end != b->end)
+    return a->end < b->end;
+  return a < b;
+}
+
+static vma_t* rotate_right(vma_t* node)
+{
+  vma_t* left = node->left;
+  node->left = left->right;
+  left->right = node;
+  vma_update(node);
+  vma_update(left);
+  return left;
+}
+
+static vma_t* rotate_left(vma_t* node)
+{
+  vma_t* right = node->right;
+  node->right = right->left;
+  right->left = node;
+  vma_update(node);
+  vma_update(right);
+  return right;
+}
+
+static vma_t* vma_balance(vma_t* node)
+{
+  vma_update(node);
+  const int balance = vma_height(node->left) - vma_height(node->right);
+  if (balance > 1)
+  {
+    if (vma_height(node->left->left) < vma_height(node->left->right))
+      node->left = rotate_left(node->left);
+    return rotate_right(node);
+  }
+  if (balance < -1)
+  {
+    if (vma_height(node->right->right) < vma_height(node->right->left))
+      node->right = rotate_right(node->right);
+    return rotate_left(node);
+  }
+  return node;
+}
+
+static vma_t* tree_insert(vma_t* node, vma_t* vma)
+{
+  if (node == NULL)
+    return vma;
+
+  if (vma_before(vma, node))
+    node->left = tree_insert(node->left, vma);
+  else
+    node->right = tree_insert(node->right, vma);
+  return vma_balance(node);
+}
+
+static vma_t* tree_remove_min(vma_t* node, vma_t** min)
+{
+  if (node->left == NULL)
+  {
+    *min = node;
+    return node->right;
+  }
+
+  node->left = tree_remove_min(node->left, min);
+  return vma_balance(node);
+}
+
+static vma_t* tree_remove(vma_t* node, vma_t* vma)
+{
+  assert(node, "vma_remove(): area not in tree");
+  if (node == vma)
+  {
+    if (node->right == NULL)
+      return node->left;
+
+    /* replace the node by its in-order successor */
+    vma_t* successor;
+    vma_t* right = tree_remove_min(node->right, &successor);
+    successor->left = node->left;
+    successor->right = right;
+    return vma_balance(successor);
+  }
+
+  if (vma_before(vma, node))
+    node->left = tree_remove(node->left, vma);
+  else
+    node->right = tree_remove(node->right, vma);
+  return vma_balance(node);
+}
+
+static void tree_destroy(vma_t* node)
+{
+  if (node == NULL)
+    return;
+
+  tree_destroy(node->left);
+  tree_destroy(node->right);
+  vma_free(node);
+}
+
+static void tree_clone(proc_t* child, vma_t* node)
+{
+  if (node == NULL)
+    return;
+
+  tree_clone(child, node->left);
+  if (!(node->flags & VMA_NOFORK))
+  {
+    vma_t* copy = vma_create(node->start, node->end, node->prot,
+                             node->flags, node->ops, node->data);
+    copy->pgoff = node->pgoff;
+    if (copy->ops->open)
+      copy->ops->open(copy);
+    child->vmas = tree_insert(child->vmas, copy);
+  }
+  tree_clone(child, node->right);
+}
+
+vma_t* vma_create(size_t start, size_t end, int prot, int flags,
+                  const vma_ops_t* ops, void* data)
+{
+  assert(start <= end, "vma_create(): invalid range");
+
+  vma_t* vma = kmem_cache_alloc(&vma_cache);
+  vma->start = start;
+  vma->end = end;
+  vma->prot = prot;
+  vma->flags = flags;
+  vma->ops = ops;
+  vma->data = data;
+  vma->pgoff = 0;
+  vma->left = NULL;
+  vma->right = NULL;
+  vma->height = 1;
+  return vma;
+}
+
+void vma_free(vma_t* vma)
+{
+  if (vma->ops->close)
+    vma->ops->close(vma);
+  kmem_free(vma);
+}
+
+int vma_insert(proc_t* proc, vma_t* vma)
+{
+  assert(rwlock_write_held(&proc->vma_lock), "VMA tree not locked");
+
+  if (vma_overlap(proc, vma->start, vma->end))
+    return -EEXIST;
+
+  vma->left = NULL;
+  vma->right = NULL;
+  vma->height = 1;
+  proc->vmas = tree_insert(proc->vmas, vma);
+
+  debug(VSPACE, "PID %zu: %s area @ %p-%p\n", proc->pid, vma->ops->name,
+        vma->start << PAGE_SHIFT, vma->end << PAGE_SHIFT);
+  return SUCCESS;
+}
+
+void vma_remove(proc_t* proc, vma_t* vma)
+{
+  assert(rwlock_write_held(&proc->vma_lock), "VMA tree not locked");
+  proc->vmas = tree_remove(proc->vmas, vma);
+}
+
+vma_t* vma_split(proc_t* proc, vma_t* vma, size_t page)
+{
+  assert(rwlock_write_held(&proc->vma_lock), "VMA tree not locked");
+  assert(page > vma->start && page < vma->end, "vma_split(): invalid page");
+
+  /* shrinking the area doesn't change its position
+   * in the tree, so the upper part can just be added. */
+  vma_t* upper = vma_create(page, vma->end, vma->prot, vma->flags,
+                            vma->ops, vma->data);
+  upper->pgoff = vma->pgoff + (page - vma->start);
+  if (upper->ops->open)
+    upper->ops->open(upper);
+  vma->end = page;
+  proc->vmas = tree_insert(proc->vmas, upper);
+  return upper;
+}
+
+vma_t* vma_find(proc_t* proc, size_t virt_page)
+{
+  assert(rwlock_held(&proc->vma_lock), "VMA tree not locked");
+
+  vma_t* node = proc->vmas;
+  while (node)
+  {
+    if (virt_page < node->start)
+      node = node->left;
+    else if (virt_page >= node->end)
+      node = node->right;
+    else
+      return node;
+  }
+  return NULL;
+}
+
+vma_t* vma_overlap(proc_t* proc, size_t start, size_t end)
+{
+  assert(rwlock_held(&proc->vma_lock), "VMA tree not locked");
+
+  /* as areas don't overlap, everything in the left
+   * subtree ends before the node starts and everything
+   * in the right subtree starts after it ends. once an
+   * overlapping area is found, the left subtree might
+   * still contain a lower one. */
+  vma_t* lowest = NULL;
+  vma_t* node = proc->vmas;
+  while (node)
+  {
+    if (end <= node->start)
+    {
+      node = node->left;
+    }
+    else if (start >= node->end)
+    {
+      node = node->right;
+    }
+    else
+    {
+      lowest = node;
+      node = node->left;
+    }
+  }
+  return lowest;
+}
+
+void vma_destroy_all(proc_t* proc)
+{
+  /* the process is gone, nobody else can hold the lock */
+  tree_destroy(proc->vmas);
+  proc->vmas = NULL;
+  proc->heap_vma = NULL;
+}
+
+void vma_clone(proc_t* parent, proc_t* child)
+{
+  rwlock_read_lock(&parent->vma_lock);
+  rwlock_write_lock(&child->vma_lock);
+  tree_clone(child, parent->vmas);
+  rwlock_write_unlock(&child->vma_lock);
+  rwlock_read_unlock(&parent->vma_lock);
+}
+
+int vma_fault(proc_t* proc, size_t virt_page,
+              int present, int write, int exec)
+{
+  rwlock_read_lock(&proc->vma_lock);
+
+  int ret = -ENOENT;
+  vma_t* vma = vma_find(proc, virt_page);
+  if (vma)
+  {
+    if ((vma->flags & VMA_NOACCESS) ||
+        (write && !(vma->prot & PG_WRITE)) ||
+        (exec && (vma->prot & PG_NOEXEC)))
+      ret = -EFAULT;
+    else if (present)
+      ret = write ? vspace_cow(proc->vspace, virt_page) : -EFAULT;
+    else
+      ret = vma->ops->fault(proc, vma, virt_page);
+  }
+
+  rwlock_read_unlock(&proc->vma_lock);
+  return ret;
+}
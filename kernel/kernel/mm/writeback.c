@@ -0,0 +1,106 @@
+/*
+ * UlmerOS write-back
+ * Copyright (C) 2021 Alexander Ulmer
+ *
+ * writes only modify the page cache and the buffer cache,
+ * which keep track of what is dirty. the flusher task writes
+ * dirty file pages back to their file systems and dirty
+ * buffers back to their devices, either once they have
+ * been dirty for a while or when there is too much dirty
+ * data (or too little free memory). file pages go first,
+ * as writing them back allocates blocks and thereby
+ * dirties file system metadata in the buffer cache.
+ * whatever can't be written stays dirty and is retried
+ * by the periodic flush, fsync() and sync() report the
+ * error.
+ */
+
+#include <mm/writeback.h>
+#include <mm/pagecache.h>
+#include <mm/memory.h>
+#include <fs/blockdev.h>
+#include <sched/task.h>
+#include <sched/sched.h>
+#include <debug.h>
+#include <errno.h>
+
+/* only one flush runs at a time */
+static mutex_t flush_lock = MUTEX_INITIALIZER;
+static size_t flush_requested = false;
+
+static int flush(size_t min_age)
+{
+  mutex_lock(&flush_lock);
+  int error = pagecache_writeback(min_age);
+  if (bcache_flush(min_age) < 0)
+    error = -EIO;
+  mutex_unlock(&flush_lock);
+  return error;
+}
+
+static int under_pressure()
+{
+  return flush_requested ||
+         pagecache_dirty() > DIRTY_BACKGROUND_PAGES ||
+         bcache_dirty() > DIRTY_BACKGROUND_BUFFERS ||
+         free_page_count() < PAGECACHE_LOW_WATER;
+}
+
+static void flusher_task_func()
+{
+  size_t last_flush = ticks();
+  int failed = false;
+  for (;;)
+  {
+    /* write back everything when there is too much
+     * dirty data, otherwise only what has expired. after
+     * a failure, the data that is dirty again is only
+     * retried once per interval. */
+    const int due = ticks() - last_flush >= WRITEBACK_INTERVAL;
+    if ((!failed || due) && under_pressure() &&
+        (pagecache_dirty() || bcache_dirty()))
+    {
+      flush_requested = false;
+      failed = flush(0) < 0;
+      last_flush = ticks();
+    }
+    else if (due)
+    {
+      flush_requested = false;
+      failed = flush(DIRTY_EXPIRE) < 0;
+      last_flush = ticks();
+    }
+
+    yield();
+  }
+}
+
+void writeback_init()
+{
+  debug(INIT, "starting the flusher task\n");
+  task_t* flusher_task = create_kernel_task(flusher_task_func);
+  sched_insert(flusher_task);
+}
+
+void writeback_wakeup()
+{
+  flush_requested = true;
+}
+
+int writeback_sync()
+{
+  int error = flush(0);
+  if (bcache_error() < 0)
+    error = -EIO;
+  return error;
+}
+
+int writeback_file(file_t* file)
+{
+  mutex_lock(&flush_lock);
+  int error = pagecache_fsync(file);
+  if (bcache_flush(0) < 0 || bcache_error() < 0)
+    error = -EIO;
+  mutex_unlock(&flush_lock);
+  return error;
+}
@@ -1,6 +1,7 @@
 #include <sched/interrupt.h>
 #include <arch/common.h>
 #include <mm/memory.h>
+#include <mm/slab.h>
 #include <util/list.h>
 #include <debug.h>
 
@@ -14,6 +15,9 @@ typedef struct
   void* drv_data;
 } irq_handler_t;
 
+static kmem_cache_t irq_handler_cache =
+    KMEM_CACHE_INITIALIZER("irq_handler_t", sizeof(irq_handler_t));
+
 void irq_kernel_init()
 {
   list_t* l_irq_handlers = kmalloc(sizeof(list_t) * IRQ_COUNT);
@@ -32,7 +36,7 @@ void irq_subscribe(size_t irq, const char* driver,
   }
 
   preempt_disable();
-  irq_handler_t* handler = kmalloc(sizeof(irq_handler_t));
+  irq_handler_t* handler = kmem_cache_alloc(&irq_handler_cache);
   handler->func = func;
   handler->drv_data = drv;
   list_add(&irq_handlers[irq], handler);
@@ -1,8 +1,10 @@
 #include <sched/loader.h>
 #include <sched/task.h>
+#include <sched/proc.h>
 #include <arch/definitions.h>
 #include <util/string.h>
 #include <mm/memory.h>
+#include <mm/pagecache.h>
 #include <fs/vfs.h>
 #include <debug.h>
 #include <errno.h>
@@ -90,49 +92,138 @@ static int load_pht(loader_t* ldr)
   return SUCCESS;
 }
 
-static int loader_map_page(loader_t* ldr,
-    elf64_phte_t* phte, size_t virt_page, vspace_t* vspace)
+static int loader_read_pages(loader_t* ldr, elf64_phte_t* phte,
+    size_t virt_page, size_t count, int flags, vspace_t* vspace)
 {
-  assert(mutex_held(&ldr->lock), "loader lock not held");
-
-  /* load the correct ELF file contents into the
-   * the newly allocated page, which must have
-   * already been cleared to zero.  */
-  size_t ppn = alloc_page();
-  void* virt_ptr = ppn_to_virt(ppn);
+  /* the pages are read into physically contiguous frames
+   * with a single request. if there is no contiguous
+   * memory, they are loaded one by one. */
+  size_t first;
+  if (count == 1)
+  {
+    first = alloc_page(PAGE_NOZERO);
+  }
+  else
+  {
+    void* region = alloc_contig(count * PAGE_SIZE, PAGE_SIZE, 0, ZONE_NORMAL);
+    if (region == NULL)
+    {
+      int mapped = 0;
+      for (size_t i = 0; i < count; i++)
+      {
+        int status = loader_read_pages(ldr, phte, virt_page + i, 1, flags, vspace);
+        if (status < 0)
+          return status;
+        mapped += status;
+      }
+      return mapped;
+    }
+    first = (size_t)region >> PAGE_SHIFT;
+  }
 
+  /* calculate the amount of bytes to be read from file.
+   * anything beyond p_filesz (.bss) has to be zero. */
   const size_t f_addr = virt_page << PAGE_SHIFT;
-
-  if (phte->p_vaddr + phte->p_memsz > f_addr)
+  const size_t file_end = phte->p_vaddr + phte->p_filesz;
+  size_t read_size = 0;
+  if (file_end > f_addr)
+    read_size = min(file_end - f_addr, count * PAGE_SIZE);
+
+  char* data = ppn_to_virt(first);
+  ssize_t bytes = 0;
+  if (read_size > 0)
   {
-    /* calculate the amount of bytes to be read from file */
-    size_t read_size = PAGE_SIZE;
-    if (phte->p_vaddr + phte->p_memsz < f_addr + PAGE_SIZE)
-      read_size = phte->p_vaddr + phte->p_memsz - f_addr;
-
-    /* seek to the correct file location */
+    /* load the memory contents from the ELF binary file. the
+     * file position is not used, so faults can run in parallel. */
     const size_t read_offset = phte->p_offset + f_addr - phte->p_vaddr;
-    vfs_seek(ldr->file, read_offset, SEEK_SET);
-
-    /* load the memory contents from the ELF binary file */
-    assert(read_size <= PAGE_SIZE, "invalid read size calculation");
-    if (vfs_read(ldr->file, virt_ptr, read_size) < 0)
+    bytes = vfs_pread(ldr->file, data, read_size, read_offset);
+    if (bytes < 0)
     {
-      free_page(ppn);
+      for (size_t i = 0; i < count; i++)
+        free_page(first + i);
       return -EIO;
     }
   }
 
-  /* set read/write/execute permissions for the page */
+  /* clear .bss and whatever a short read left over */
+  memset(data + bytes, 0, count * PAGE_SIZE - bytes);
+
+  /* map the pages, unless another thread was faster */
+  int mapped = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (vspace_map(vspace, virt_page + i, first + i, flags) < 0)
+      free_page(first + i);
+    else
+      mapped++;
+  }
+
+  debug(LOADER, "loading %zu pages with code/data @ %p\n",
+        count, f_addr);
+  return mapped;
+}
+
+static int loader_map_pages(loader_t* ldr, elf64_phte_t* phte,
+    size_t virt_page, size_t count, vspace_t* vspace)
+{
+  assert(count <= FAULT_AROUND_MAX, "too many pages to be mapped");
+
+  /* set read/write/execute permissions for the pages */
   int flags = PG_USER;
   if ((phte->flags & BIT(0)) == 0)  flags |= PG_NOEXEC;
   if (phte->flags & BIT(1))         flags |= PG_WRITE;
 
-  /* map the page */
-  vspace_map(vspace, virt_page, ppn, flags);
-  debug(LOADER, "loading PPN %zu with code/data @ %p\n",
-        ppn, virt_page << PAGE_SHIFT);
-  return SUCCESS;
+  /* pages of read-only segments that are entirely backed
+   * by the file are mapped straight from the page cache,
+   * so all processes running the binary share them. only
+   * writable segments and pages containing .bss receive a
+   * private copy. */
+  const size_t read_offset =
+      phte->p_offset + (virt_page << PAGE_SHIFT) - phte->p_vaddr;
+  const size_t file_end = phte->p_vaddr + phte->p_filesz;
+  const size_t mem_end = phte->p_vaddr + phte->p_memsz;
+
+  size_t shared = 0;
+  if (!(flags & PG_WRITE) && read_offset % PAGE_SIZE == 0)
+  {
+    size_t shared_end = virt_page + count;
+    if (mem_end > file_end)
+      shared_end = min(shared_end, file_end >> PAGE_SHIFT);
+    if (shared_end > virt_page)
+      shared = shared_end - virt_page;
+  }
+
+  int mapped = 0;
+  if (shared > 0)
+  {
+    size_t ppns[FAULT_AROUND_MAX];
+    int error = pagecache_get_range(ldr->file,
+        read_offset >> PAGE_SHIFT, shared, ppns);
+    if (error < 0)
+      return error;
+
+    for (size_t i = 0; i < shared; i++)
+    {
+      if (vspace_map(vspace, virt_page + i, ppns[i], flags) < 0)
+        free_page(ppns[i]);
+      else
+        mapped++;
+    }
+
+    debug(LOADER, "mapping %zu shared pages with code @ %p\n",
+          shared, virt_page << PAGE_SHIFT);
+  }
+
+  if (shared < count)
+  {
+    int status = loader_read_pages(ldr, phte, virt_page + shared,
+                                   count - shared, flags, vspace);
+    if (status < 0)
+      return status;
+    mapped += status;
+  }
+
+  return mapped;
 }
 
 static int load_heap_brk(loader_t* ldr)
@@ -219,7 +310,45 @@ loader_t *loader_create(fd_t *file)
   return ldr;
 }
 
-int loader_load(loader_t *ldr, size_t virt_page, vspace_t *vspace)
+static int loader_fault(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  loader_t* ldr = proc->loader;
+  elf64_phte_t* phte = vma->data;
+
+  /* load the surrounding pages of the segment as well
+   * (fault-around), except for those already present.
+   * every run of missing pages is loaded at once. */
+  size_t start;
+  const size_t count = fault_around(virt_page, vma->start, vma->end, &start);
+  const size_t end = start + count;
+
+  int mapped = 0;
+  size_t page = start;
+  while (page < end)
+  {
+    size_t run = 0;
+    while (page + run < end && !vspace_mapped(proc->vspace, page + run))
+      run++;
+
+    if (run > 0)
+    {
+      int status = loader_map_pages(ldr, phte, page, run, proc->vspace);
+      if (status < 0)
+        return status;
+      mapped += status;
+    }
+    page += run + 1;
+  }
+
+  return mapped;
+}
+
+static const vma_ops_t elf_vma_ops = {
+  .name = "ELF segment",
+  .fault = loader_fault
+};
+
+int loader_add_vmas(loader_t* ldr, proc_t* proc)
 {
   assert(ldr && ldr->header && ldr->file, "invalid loader_t object");
 
@@ -230,33 +359,57 @@ int loader_load(loader_t *ldr, size_t virt_page, vspace_t *vspace)
      * it hasn't yet been loaded. */
     int status = load_pht(ldr);
     if (status < 0)
+    {
+      mutex_unlock(&ldr->lock);
       return status;
+    }
   }
 
-  const size_t vaddr = virt_page << PAGE_SHIFT;
+  rwlock_write_lock(&proc->vma_lock);
+  size_t prev_end = 0;
+  int error = SUCCESS;
   for (size_t i = 0; i < ldr->header->pht_entries; i++)
   {
     elf64_phte_t* phte = &ldr->pht[i];
 
     /* if the ELF PHT segment type should not be loaded,
      * then don't do anything. */
-    if (phte->type != LOAD)
+    if (phte->type != LOAD || phte->p_memsz == 0)
       continue;
 
-    /* check whether the fault address lies inbetween the
-     * boundaries of the current segment. */
-    if (vaddr >= phte->p_vaddr &&
-        vaddr < phte->p_vaddr + phte->p_memsz)
+    /* segments are sorted by address. if two of them
+     * share a page, it belongs to the first one. */
+    size_t start = phte->p_vaddr >> PAGE_SHIFT;
+    const size_t end =
+        (phte->p_vaddr + phte->p_memsz + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    start = max(start, prev_end);
+    if (start >= end)
+      continue;
+
+    int prot = 0;
+    if ((phte->flags & BIT(0)) == 0)  prot |= PG_NOEXEC;
+    if (phte->flags & BIT(1))         prot |= PG_WRITE;
+
+    vma_t* vma = vma_create(start, end, prot, 0, &elf_vma_ops, phte);
+    if ((error = vma_insert(proc, vma)) < 0)
     {
-      int status = loader_map_page(ldr, phte, virt_page, vspace);
-      mutex_unlock(&ldr->lock);
-      return status;
+      vma_free(vma);
+      break;
     }
+    prev_end = end;
   }
+  rwlock_write_unlock(&proc->vma_lock);
 
-  debug(LOADER, "no loadable section refers to address %p\n", vaddr);
   mutex_unlock(&ldr->lock);
-  return -ENOENT;
+  return error;
+}
+
+loader_t* loader_dup(loader_t* ldr)
+{
+  mutex_lock(&ldr->lock);
+  ldr->refs++;
+  mutex_unlock(&ldr->lock);
+  return ldr;
 }
 
 void loader_release(loader_t *ldr)
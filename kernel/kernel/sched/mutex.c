@@ -43,6 +43,19 @@ void mutex_lock(mutex_t* mtx)
   mtx->held_by = current_task;
 }
 
+int mutex_trylock(mutex_t* mtx)
+{
+  CHECK_MAGIC(mtx);
+
+  /* acquire the mutex only if that is possible
+   * without going to sleep. */
+  if (xchg(1, &mtx->lock))
+    return false;
+
+  mtx->held_by = current_task;
+  return true;
+}
+
 void mutex_unlock(mutex_t* mtx)
 {
   CHECK_MAGIC(mtx);
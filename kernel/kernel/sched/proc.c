@@ -5,6 +5,7 @@
 #include <sched/loader.h>
 #include <sched/userstack.h>
 #include <mm/memory.h>
+#include <mm/slab.h>
 #include <mm/vspace.h>
 #include <fs/vfs.h>
 #include <arch/common.h>
@@ -14,15 +15,24 @@
 
 static size_t pid_counter = 1;
 
+static kmem_cache_t user_fd_cache =
+    KMEM_CACHE_INITIALIZER("user_fd_t", sizeof(user_fd_t));
+
 static void proc_base_init(proc_t* proc)
 {
   proc->state = PROC_RUNNING;
   proc->pid = atomic_add(&pid_counter, 1);
+  proc->faults = 0;
+  proc->fault_pages = 0;
 
   list_init(&proc->task_list);
   list_init(&proc->fd_list);
   list_init(&proc->stack_list);
 
+  proc->vmas = NULL;
+  proc->heap_vma = NULL;
+  rwlock_init(&proc->vma_lock);
+
   mutex_init(&proc->heap_lock);
   mutex_init(&proc->task_list_lock);
   mutex_init(&proc->fd_list_lock);
@@ -60,6 +70,9 @@ int proc_start(const char *filename)
    * start address */
   proc->loader = ldr;
   proc->heap_brk = ldr->min_heap_break;
+  if ((error = loader_add_vmas(ldr, proc)) < 0)
+    return error;
+  heap_init(proc);
 
   /* create a new stack for the main thread. */
   userstack_t* stack = create_stack(proc);
@@ -74,6 +87,53 @@ int proc_start(const char *filename)
   return SUCCESS;
 }
 
+ssize_t sys_fork()
+{
+  proc_t* parent = current_task->process;
+  proc_t* child = kmalloc(sizeof(proc_t));
+  proc_base_init(child);
+  child->uid = parent->uid;
+  child->gid = parent->gid;
+  child->working_dir = parent->working_dir;
+  child->loader = loader_dup(parent->loader);
+
+  /* the child shares all open files with the parent */
+  mutex_lock(&parent->fd_list_lock);
+  child->fd_counter = parent->fd_counter;
+  for (list_item_t* it = list_it_front(&parent->fd_list);
+       it != LIST_IT_END;
+       it = list_it_next(it))
+  {
+    user_fd_t* user_fd = kmem_cache_alloc(&user_fd_cache);
+    *user_fd = *(user_fd_t*)list_it_get(it);
+    list_add(&child->fd_list, user_fd);
+  }
+  mutex_unlock(&parent->fd_list_lock);
+
+  /* copy the address space and its memory areas. the
+   * heap lock keeps the heap break consistent with the
+   * heap mappings. */
+  mutex_lock(&parent->heap_lock);
+  child->heap_brk = parent->heap_brk;
+  child->vspace = vspace_clone(parent->vspace);
+  vma_clone(parent, child);
+  heap_init(child);
+  mutex_unlock(&parent->heap_lock);
+
+  fork_stacks(parent, child, current_task->user_stack);
+
+  /* create a copy of the calling thread, which
+   * will be the main thread of the new process. */
+  task_t* main_thread = create_forked_task(child->vspace, current_task);
+  main_thread->process = child;
+  list_add(&child->task_list, main_thread);
+
+  debug(PROCESS, "PID %zu: fork() created PID %zu\n",
+        parent->pid, child->pid);
+  sched_insert(main_thread);
+  return child->pid;
+}
+
 fd_t *proc_get_fd(proc_t *process, int fd)
 {
   if (fd < 0)
@@ -105,7 +165,7 @@ int proc_new_fd(proc_t *process, fd_t *fd)
   const size_t new_fd = atomic_add(&process->fd_counter, 1);
 
   /* create a new file descriptor list entry */
-  user_fd_t* userfd = kmalloc(sizeof(user_fd_t));
+  user_fd_t* userfd = kmem_cache_alloc(&user_fd_cache);
   userfd->fd_ptr = fd;
   userfd->user_fd = new_fd;
 
@@ -121,12 +181,14 @@ int proc_new_fd(proc_t *process, fd_t *fd)
 void sys_exit(int status)
 {
   kpanic(current_task->process, "user task has no associated process");
-  debug(PROCESS, "exit(%d) called by PID %zu\n",
-        status, current_task->process->pid);
+  proc_t* process = current_task->process;
+  debug(PROCESS, "exit(%d) called by PID %zu (%zu page faults, "
+        "%zu pages mapped)\n", status, process->pid,
+        process->faults, process->fault_pages);
 
   /* by setting the current process state to killed,
    * all other threads will be killed during the next
    * few time slices. */
-  current_task->process->state = PROC_KILLED;
+  process->state = PROC_KILLED;
   task_kill();
 }
@@ -0,0 +1,55 @@
+#include <sched/rwlock.h>
+#include <sched/sched.h>
+#include <arch/common.h>
+#include <debug.h>
+
+void rwlock_init(rwlock_t* rw)
+{
+  mutex_init(&rw->writer);
+  rw->readers = 0;
+}
+
+void rwlock_destroy(rwlock_t* rw)
+{
+  assert(rw->readers == 0, "destroying rwlock while held");
+  mutex_destroy(&rw->writer);
+}
+
+void rwlock_read_lock(rwlock_t* rw)
+{
+  /* readers only pass the writer mutex, so they
+   * have to wait for active and waiting writers. */
+  mutex_lock(&rw->writer);
+  atomic_add(&rw->readers, 1);
+  mutex_unlock(&rw->writer);
+}
+
+void rwlock_read_unlock(rwlock_t* rw)
+{
+  assert(rw->readers > 0, "rwlock released but not locked");
+  atomic_add(&rw->readers, -1);
+}
+
+void rwlock_write_lock(rwlock_t* rw)
+{
+  /* new readers can't enter once the writer mutex is
+   * held, so wait for the remaining ones to leave. */
+  mutex_lock(&rw->writer);
+  while (rw->readers)
+    yield();
+}
+
+void rwlock_write_unlock(rwlock_t* rw)
+{
+  mutex_unlock(&rw->writer);
+}
+
+int rwlock_write_held(rwlock_t* rw)
+{
+  return mutex_held(&rw->writer);
+}
+
+int rwlock_held(rwlock_t* rw)
+{
+  return rw->readers > 0 || mutex_held(&rw->writer);
+}
@@ -16,7 +16,10 @@ static void idle_task_func()
 {
   for (;;)
   {
-    idle();
+    /* use idle time to clear free pages in advance and
+     * only halt the cpu once there is nothing left to do. */
+    if (!page_prezero())
+      idle();
   }
 }
 
@@ -36,7 +39,8 @@ void sched_init()
 
   /* install the idle task. this task will halt the
    * cpu until an interrupt or exception fires over
-   * and over again. */
+   * and over again, unless there are pages to be
+   * zeroed. */
   task_t* idle_task = create_kernel_task(idle_task_func);
   sched_insert(idle_task);
 }
@@ -87,9 +91,12 @@ context_t* schedule(context_t* ctx)
      * context switch. */
     ctx = next_task->context;
 
-    /* if different, switch the virtual address
-     * space to the one of the new task. */
-    if (!current_task || current_task->vspace != next_task->vspace)
+    /* switch to the virtual address space of the new
+     * task. kernel tasks only use the upper half, which is
+     * the same everywhere, so they just borrow the address
+     * space that is active already. vspace_apply() doesn't
+     * touch CR3 if the address space doesn't change. */
+    if (next_task->vspace != VSPACE_KERNEL)
       vspace_apply(next_task->vspace);
 
     /* set the stack pointer that will be used
@@ -0,0 +1,38 @@
+#include <sched/seqlock.h>
+#include <sched/sched.h>
+#include <debug.h>
+
+void seqcount_init(seqcount_t* seq)
+{
+  seq->sequence = 0;
+}
+
+size_t read_seqbegin(seqcount_t* seq)
+{
+  /* the sequence is odd while a writer is active. the
+   * writer might have been preempted, so let it run. */
+  size_t start;
+  while ((start = *(volatile size_t*)&seq->sequence) & 1)
+    yield();
+  barrier();
+  return start;
+}
+
+int read_seqretry(seqcount_t* seq, size_t start)
+{
+  barrier();
+  return *(volatile size_t*)&seq->sequence != start;
+}
+
+void write_seqbegin(seqcount_t* seq)
+{
+  assert((seq->sequence & 1) == 0, "nested seqcount write");
+  seq->sequence++;
+  barrier();
+}
+
+void write_seqend(seqcount_t* seq)
+{
+  barrier();
+  seq->sequence++;
+}
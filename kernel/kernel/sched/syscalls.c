@@ -8,13 +8,13 @@ void* syscall_table[] = {
   sys_read,       // 0x02
   sys_write,      // 0x03
   sys_close,      // 0x04
-  UNIM,           // 0x05
-  UNIM,           // 0x06
-  UNIM,           // 0x07
-  UNIM,           // 0x08
-  UNIM,           // 0x09
-  UNIM,           // 0x0a
-  UNIM,           // 0x0b
+  sys_fork,       // 0x05
+  sys_open,       // 0x06
+  sys_fsync,      // 0x07
+  sys_sync,       // 0x08
+  sys_mmap,       // 0x09
+  sys_mprotect,   // 0x0a
+  sys_munmap,     // 0x0b
   UNIM,           // 0x0c
   UNIM,           // 0x0d
   sys_sbrk,       // 0x0e
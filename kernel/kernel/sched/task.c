@@ -4,12 +4,16 @@
 #include <sched/tasklist.h>
 #include <sched/interrupt.h>
 #include <mm/memory.h>
+#include <mm/slab.h>
 #include <arch/context.h>
 #include <arch/common.h>
 #include <debug.h>
 
 static size_t tid_counter = 1;
 
+static kmem_cache_t task_cache =
+    KMEM_CACHE_INITIALIZER("task_t", sizeof(task_t));
+
 static void ktask_runtime(void (*func)())
 {
   func();
@@ -26,7 +30,7 @@ static void* stack_align(void* stack_ptr)
 
 task_t* create_kernel_task(void (*func)())
 {
-  task_t* task = kmalloc(sizeof(task_t));
+  task_t* task = kmem_cache_alloc(&task_cache);
   task->kstack_base = kmalloc(KSTACK_SIZE);
   task->kstack_ptr = stack_align(task->kstack_base + KSTACK_SIZE);
   task->context = context_init(
@@ -48,7 +52,7 @@ task_t* create_kernel_task(void (*func)())
 
 task_t* create_user_task(vspace_t* vspace, void* entry, userstack_t* stack)
 {
-  task_t* task = kmalloc(sizeof(task_t));
+  task_t* task = kmem_cache_alloc(&task_cache);
   task->kstack_base = kmalloc(KSTACK_SIZE);
   task->kstack_ptr = stack_align(task->kstack_base + KSTACK_SIZE);
   task->context = context_init(
@@ -69,6 +73,28 @@ task_t* create_user_task(vspace_t* vspace, void* entry, userstack_t* stack)
   return task;
 }
 
+task_t* create_forked_task(vspace_t* vspace, task_t* parent)
+{
+  task_t* task = kmem_cache_alloc(&task_cache);
+  task->kstack_base = kmalloc(KSTACK_SIZE);
+  task->kstack_ptr = stack_align(task->kstack_base + KSTACK_SIZE);
+
+  /* the new task continues right where the parent
+   * entered the kernel, but with a return value of 0. */
+  task->context = context_fork(task->kstack_ptr, parent->kstack_ptr);
+  context_set_ret(task->context, 0);
+
+  task->state = TASK_RUNNING;
+  task->tid = atomic_add(&tid_counter, 1);
+  task->vspace = vspace;
+  task->irq_wait = false;
+  task->process = NULL;
+  task->user_stack = parent->user_stack;
+  tl_insert(task);
+  debug(TASK, "forked task TID #%zu -> TID #%zu\n", parent->tid, task->tid);
+  return task;
+}
+
 void task_kill()
 {
   debug(TASK, "task #%zu terminated\n", current_task->tid);
@@ -5,6 +5,7 @@
 #include <sched/mutex.h>
 #include <mm/memory.h>
 #include <mm/vspace.h>
+#include <mm/vma.h>
 #include <debug.h>
 #include <sched/userstack.h>
 
@@ -24,6 +25,8 @@ static void proc_delete(proc_t* proc)
   mutex_destroy(&proc->heap_lock);
   mutex_destroy(&proc->stack_list_lock);
   mutex_destroy(&proc->task_list_lock);
+  vma_destroy_all(proc);
+  rwlock_destroy(&proc->vma_lock);
   vspace_delete(proc->vspace);
 }
 
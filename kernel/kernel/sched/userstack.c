@@ -1,8 +1,42 @@
 #include <sched/userstack.h>
 #include <mm/memory.h>
+#include <mm/slab.h>
+#include <arch/common.h>
 #include <errno.h>
 #include <debug.h>
 
+static int stack_fault(proc_t* proc, vma_t* vma, size_t virt_page)
+{
+  /* map the surrounding pages of the stack as well,
+   * the stack is most likely going to grow into them. */
+  userstack_t* stack = vma->data;
+  size_t start;
+  const size_t count = fault_around(virt_page, vma->start, vma->end, &start);
+  const size_t mapped = vspace_map_range(proc->vspace, start, count,
+                                         PG_NOEXEC | PG_USER | PG_WRITE);
+  atomic_add(&stack->pages_mapped, mapped);
+  return mapped;
+}
+
+static const vma_ops_t stack_vma_ops = {
+  .name = "stack",
+  .fault = stack_fault
+};
+
+static void stack_add_vma(proc_t* proc, userstack_t* stack)
+{
+  /* stacks are not inherited by forked children, which
+   * only get the stack of the forking thread. */
+  stack->vma = vma_create(stack->start_page,
+      stack->start_page + stack->page_count, PG_WRITE | PG_NOEXEC,
+      VMA_NOFORK, &stack_vma_ops, stack);
+
+  rwlock_write_lock(&proc->vma_lock);
+  int error = vma_insert(proc, stack->vma);
+  rwlock_write_unlock(&proc->vma_lock);
+  kpanic(error == SUCCESS, "stack overlaps another memory area");
+}
+
 userstack_t *create_stack(proc_t* proc)
 {
   mutex_lock(&proc->stack_list_lock);
@@ -14,6 +48,7 @@ userstack_t *create_stack(proc_t* proc)
     if (!stack->allocated)
     {
       stack->allocated = true;
+      stack_add_vma(proc, stack);
       mutex_unlock(&proc->stack_list_lock);
       return stack;
     }
@@ -33,35 +68,12 @@ userstack_t *create_stack(proc_t* proc)
   stack->stack_ptr =
       (void*)((start_page + (STACK_SIZE >> PAGE_SHIFT)) << PAGE_SHIFT);
   list_add(&proc->stack_list, stack);
+  stack_add_vma(proc, stack);
 
   mutex_unlock(&proc->stack_list_lock);
   return stack;
 }
 
-int stack_load(proc_t *proc, size_t virt_page)
-{
-  int ret = -ENOENT;
-  mutex_lock(&proc->stack_list_lock);
-  for (list_item_t* it = list_it_front(&proc->stack_list);
-       it != LIST_IT_END;
-       it = list_it_next(it))
-  {
-    userstack_t* stack = list_it_get(it);
-    if (stack->allocated &&
-        virt_page >= stack->start_page &&
-        virt_page < stack->start_page + stack->page_count)
-    {
-      size_t ppn = alloc_page();
-      vspace_map(proc->vspace, virt_page, ppn, PG_NOEXEC | PG_USER | PG_WRITE);
-      stack->pages_mapped++;
-      ret = SUCCESS;
-      break;
-    }
-  }
-  mutex_unlock(&proc->stack_list_lock);
-  return ret;
-}
-
 void delete_stack(proc_t *process, size_t index)
 {
   mutex_lock(&process->stack_list_lock);
@@ -69,15 +81,18 @@ void delete_stack(proc_t *process, size_t index)
   assert(stack && stack->allocated, "stack index invalid or not allocated");
   stack->allocated = 0;
 
+  rwlock_write_lock(&process->vma_lock);
+  vma_remove(process, stack->vma);
+  rwlock_write_unlock(&process->vma_lock);
+  kmem_free(stack->vma);
+  stack->vma = NULL;
+
   /* unmap all the stack pages */
   debug(TASK, "unwinding stack of PID %zu and index %zu\n",
         process->pid, index);
-  size_t end_page = stack->start_page + stack->page_count - 1;
-  while (stack->pages_mapped)
-  {
-    if (vspace_unmap(process->vspace, end_page--))
-      stack->pages_mapped -= 1;
-  }
+  stack->pages_mapped -= vspace_unmap_range(process->vspace,
+      stack->start_page, stack->page_count);
+  assert(stack->pages_mapped == 0, "stack pages left mapped");
 
   list_item_t* it;
   for (;;)
@@ -93,3 +108,31 @@ void delete_stack(proc_t *process, size_t index)
   }
   mutex_unlock(&process->stack_list_lock);
 }
+
+void fork_stacks(proc_t* parent, proc_t* child, size_t index)
+{
+  mutex_lock(&parent->stack_list_lock);
+  for (list_item_t* it = list_it_front(&parent->stack_list);
+       it != LIST_IT_END;
+       it = list_it_next(it))
+  {
+    userstack_t* copy = kmalloc(sizeof(userstack_t));
+    *copy = *(userstack_t*)list_it_get(it);
+
+    /* the child only runs the forking thread, the
+     * other threads' stacks are not needed there. */
+    if (copy->index != index)
+    {
+      copy->allocated = false;
+      vspace_unmap_range(child->vspace, copy->start_page, copy->page_count);
+      copy->pages_mapped = 0;
+      copy->vma = NULL;
+    }
+    else
+    {
+      stack_add_vma(child, copy);
+    }
+    list_add(&child->stack_list, copy);
+  }
+  mutex_unlock(&parent->stack_list_lock);
+}
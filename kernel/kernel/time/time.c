@@ -1,6 +1,18 @@
 #include <time.h>
 
+static size_t timer_ticks = 0;
+
 uint64_t time()
 {
   return 0;
 }
+
+size_t ticks()
+{
+  return timer_ticks;
+}
+
+void timer_tick()
+{
+  timer_ticks++;
+}
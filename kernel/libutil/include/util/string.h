@@ -29,6 +29,7 @@ char* ptoa(void *value, char * str);
 char* ltoa(long value, char * str, int base);
 char* utoa(unsigned int value, char * str, int base);
 char* ultoa(unsigned long value, char * str, int base);
+unsigned long strtoul(const char* str, char** endptr, int base);
 const char* strccpy(char *dest, const char *src, char terminator);
 size_t strclen(const char* src, char terminator);
 const char *strexcept(unsigned exc);
@@ -236,6 +236,31 @@ char* ultoa(unsigned long value, char * str, int base)
   return strrev(str);
 }
 
+unsigned long strtoul(const char* str, char** endptr, int base)
+{
+  unsigned long value = 0;
+  for (;; str++)
+  {
+    unsigned digit;
+    if (*str >= '0' && *str <= '9')
+      digit = *str - '0';
+    else if (*str >= 'a' && *str <= 'z')
+      digit = *str - 'a' + 10;
+    else if (*str >= 'A' && *str <= 'Z')
+      digit = *str - 'A' + 10;
+    else
+      break;
+
+    if (digit >= (unsigned)base)
+      break;
+    value = value * base + digit;
+  }
+
+  if (endptr)
+    *endptr = (char*)str;
+  return value;
+}
+
 char* ptoa(void* value, char *str)
 {
   char *bufPtr = str;